@@ -0,0 +1,546 @@
+#include "batch_rollout.hpp"
+#include <algorithm>
+#include <array>
+
+namespace
+{
+    // Stacks are kept as TreasureStack::code() bytes: chip levels in bits 0-5, chip count in bits 6-7
+    int chipCount(uint8_t code)
+    {
+        return code >> 6;
+    }
+
+    int chipAt(uint8_t code, int index)
+    {
+        return (code >> (2 * index)) & 3;
+    }
+
+    uint8_t pushChip(uint8_t code, int level)
+    {
+        int count = chipCount(code);
+        return static_cast<uint8_t>(((count + 1) << 6) | (code & 0x3F) | (level << (2 * count)));
+    }
+
+    // a when c holds, otherwise b, without a branch
+    template <typename T>
+    T blend(bool c, T a, T b)
+    {
+        T mask = T(0) - T(c);
+        return (a & mask) | (b & ~mask);
+    }
+
+    // bit of tile `position` in the board masks; 0 for the submarine
+    uint64_t tileBit(int position)
+    {
+        return blend(position != 0, uint64_t(1) << ((position - 1) & 63), uint64_t(0));
+    }
+
+    // the first `size` tiles, size in [0, 64]
+    uint64_t tilesBelow(int size)
+    {
+        return blend(size >= 64, ~uint64_t(0), (uint64_t(1) << (size & 63)) - 1);
+    }
+
+    constexpr int PICK = 1 << 6; // DECISIONS flag: choose between the two options
+
+    /**
+     * State::getPossibleMoves, narrowed by the rollout policy, as a table. The key packs moved,
+     * returning, at the submarine, carrying or at the bottom, may collect, may drop and must
+     * drop into bits 0-6; the entry holds the moves three bits each, first option lowest, plus
+     * PICK when there are two. Collecting and dropping exclude each other, so there are never
+     * more than two options.
+     */
+    constexpr std::array<uint8_t, 128> buildDecisions()
+    {
+        std::array<uint8_t, 128> table{};
+        for (int key = 0; key < 128; key++)
+        {
+            bool moved = key & 1, ret = key & 2, atSub = key & 4, mayReturn = key & 8;
+            bool collect = key & 16, drop = key & 32, mustDrop = key & 64;
+
+            int entry = LEAVE_TREASURE;
+            if (!moved)
+                entry = ret ? (atSub ? LEAVE_TREASURE : RETURN)
+                            : mayReturn ? (CONTINUE | RETURN << 3 | PICK) : CONTINUE;
+            else if (drop && mustDrop)
+                entry = DROP_TREASURE;
+            else if (collect || drop)
+                entry = (collect ? COLLECT_TREASURE : DROP_TREASURE) | LEAVE_TREASURE << 3 | PICK;
+            table[key] = static_cast<uint8_t>(entry);
+        }
+        return table;
+    }
+
+    constexpr std::array<uint8_t, 128> DECISIONS = buildDecisions();
+
+    constexpr int MAX_STEPS = 10000; // decisions per rollout before it is cut off
+}
+
+void BatchRollout::run(const State &state, bool movedThisTurn, int rollouts, RNG &rngStream, ScoreVector *out)
+{
+    batch(state, movedThisTurn, -1, rollouts, rngStream, out);
+}
+
+void BatchRollout::runAfter(const State &state, bool movedThisTurn, MoveType firstMove, int rollouts,
+                            RNG &rngStream, ScoreVector *out)
+{
+    batch(state, movedThisTurn, firstMove, rollouts, rngStream, out);
+}
+
+void BatchRollout::batch(const State &state, bool movedThisTurn, int forcedMove, int rollouts, RNG &rngStream,
+                         ScoreVector *out)
+{
+    numPlayers = static_cast<int>(state.getPlayers().size());
+    valuation = state.getValuationPolicy();
+    rules = state.getRules();
+    forced = forcedMove;
+    count = rollouts;
+    started = 0;
+    stream = &rngStream;
+    scores = out;
+
+    if (rollouts <= 0)
+        return;
+
+    load(state, movedThisTurn);
+    lanes = std::min(rollouts, L);
+
+    switch (specialized ? numPlayers : 0) // the player count is fixed for the whole batch, so pick its kernels once
+    {
+    case 2:
+        drive<2>();
+        break;
+    case 3:
+        drive<3>();
+        break;
+    case 4:
+        drive<4>();
+        break;
+    case 5:
+        drive<5>();
+        break;
+    case 6:
+        drive<6>();
+        break;
+    default:
+        drive<0>();
+        break;
+    }
+}
+
+template <int N>
+void BatchRollout::drive()
+{
+    for (int l = 0; l < lanes; l++)
+        start<N>(l);
+
+    bool active = true;
+    while (active)
+    {
+        sweep<N>();
+
+        active = false;
+        for (int l = 0; l < lanes; l++)
+            active |= game[l] >= 0;
+    }
+}
+
+void BatchRollout::load(const State &state, bool movedThisTurn)
+{
+    const auto &players = state.getPlayers();
+    for (int p = 0; p < numPlayers; p++)
+    {
+        const Player &player = players[p];
+        position[p][ROOT] = static_cast<uint8_t>(player.getPosition());
+        returning[p][ROOT] = player.getIsReturning();
+        dead[p][ROOT] = player.getIsDead();
+        points[p][ROOT] = player.getScore();
+
+        const Inventory &treasures = player.getTreasures();
+        carried[p][ROOT] = static_cast<uint8_t>(treasures.size());
+        for (size_t i = 0; i < treasures.size(); i++)
+            inventory[p][i][ROOT] = treasures[i].code();
+    }
+
+    const Board &board = state.getBoard();
+    const TileList &stateTiles = board.getTiles();
+    tileCount[ROOT] = static_cast<uint8_t>(stateTiles.size());
+    for (size_t i = 0; i < stateTiles.size(); i++)
+        tiles[i][ROOT] = stateTiles[i].treasure.code();
+    flipped[ROOT] = board.getFlippedMask();
+    occupied[ROOT] = board.getOccupiedMask();
+
+    oxygen[ROOT] = static_cast<int8_t>(state.getOxygen());
+    round[ROOT] = static_cast<int8_t>(state.getCurrentRound());
+    current[ROOT] = static_cast<int8_t>(state.getCurrentPlayerIndex());
+    lastPlayer[ROOT] = static_cast<int8_t>(state.getLastPlayerIndex());
+    moved[ROOT] = movedThisTurn;
+    pools[ROOT] = state.getValuePools();
+
+    safe[ROOT] = 0;
+    for (int p = 0; p < numPlayers; p++)
+        safe[ROOT] += dead[p][ROOT] | ((position[p][ROOT] == 0) & returning[p][ROOT]);
+}
+
+// puts the next rollout into the lane; once all have been started the lane replays the
+// root without recording anything, so the sweeps stay uniform until the last game ends
+template <int N>
+void BatchRollout::start(int l)
+{
+    while (true)
+    {
+        bool real = started < count;
+        game[l] = real ? started++ : -1;
+        if (real)
+            rng[l] = RNG(stream->next());
+        pending[l] = static_cast<int8_t>(forced);
+        steps[l] = 0;
+
+        for (int p = 0; p < seats<N>(); p++)
+        {
+            position[p][l] = position[p][ROOT];
+            returning[p][l] = returning[p][ROOT];
+            dead[p][l] = dead[p][ROOT];
+            points[p][l] = points[p][ROOT];
+            carried[p][l] = carried[p][ROOT];
+            for (int i = 0; i < carried[p][ROOT]; i++)
+                inventory[p][i][l] = inventory[p][i][ROOT];
+        }
+
+        tileCount[l] = tileCount[ROOT];
+        for (int i = 0; i < tileCount[ROOT]; i++)
+            tiles[i][l] = tiles[i][ROOT];
+        flipped[l] = flipped[ROOT];
+        occupied[l] = occupied[ROOT];
+
+        oxygen[l] = oxygen[ROOT];
+        round[l] = round[ROOT];
+        current[l] = current[ROOT];
+        lastPlayer[l] = lastPlayer[ROOT];
+        moved[l] = moved[ROOT];
+        pools[l] = pools[ROOT];
+        safe[l] = safe[ROOT];
+
+        // a finished game is already scored; a state left at the end of an earlier round rolls over
+        if (!isTerminal<N>(l))
+            return;
+        if (round[l] < rules.rounds - 1)
+        {
+            endRound<N>(l);
+            return;
+        }
+        if (!real)
+            return;
+
+        record<N>(l);
+    }
+}
+
+/**
+ * One decision in every lane: State::getPossibleMoves, a uniform pick and State::apply.
+ * Each phase is a loop over the lanes without data-dependent branches, so the lanes'
+ * dependency chains overlap instead of waiting on mispredictions. Lanes that pick or
+ * move are first compacted into a list, so the generators only run where State would
+ * draw; drops, table misses and round ends are the remaining branches.
+ */
+template <int N>
+void BatchRollout::sweep()
+{
+    int cur[L], pos[L], held[L], newPos[L], options[L], index[L];
+    int pickers[L], movers[L];
+    uint8_t move[L];
+    int numPickers = 0;
+    int numMovers = 0;
+
+    for (int l = 0; l < lanes; l++)
+    {
+        int c = current[l];
+        int p = position[c][l];
+        int h = carried[c][l];
+        int size = tileCount[l];
+        bool blank = (flipped[l] >> ((p - 1) & 63)) & 1; // only read off the submarine
+
+        bool collect = (p != 0) & (p <= size) & !blank;
+        bool drop = (p != 0) & (h > 0) & blank;
+        bool mustDrop = false;
+        if (policy == RolloutPolicy::CAUTIOUS)
+        {
+            // no third stack, no second one without the oxygen to get back, and shed one when stranded
+            collect &= (h == 0) | ((h == 1) & (oxygen[l] > p));
+            mustDrop = (h >= 2) & (oxygen[l] < p);
+        }
+
+        int key = moved[l] | returning[c][l] << 1 | (p == 0) << 2 | ((h > 0) | (p >= size)) << 3 | collect << 4 |
+                  drop << 5 | mustDrop << 6;
+        int entry = blend(pending[l] >= 0, int(pending[l]), int(DECISIONS[key]));
+        pending[l] = -1;
+
+        options[l] = entry & (PICK - 1);
+        index[l] = 0;
+        pickers[numPickers] = l;
+        numPickers += (entry & PICK) != 0;
+
+        cur[l] = c;
+        pos[l] = p;
+        held[l] = h;
+    }
+
+    for (int i = 0; i < numPickers; i++)
+    {
+        int l = pickers[i];
+        index[l] = static_cast<int>(rng[l].next() >> 63); // below(2)
+    }
+
+    for (int l = 0; l < lanes; l++)
+    {
+        move[l] = static_cast<uint8_t>((options[l] >> (3 * index[l])) & 7);
+        movers[numMovers] = l;
+        numMovers += move[l] <= RETURN;
+    }
+
+    // CONTINUE / RETURN
+    for (int i = 0; i < numMovers; i++)
+    {
+        int l = movers[i];
+        int c = cur[l];
+        int p = pos[l];
+        int h = held[l];
+        int size = tileCount[l];
+
+        oxygen[l] = static_cast<int8_t>(std::max(0, oxygen[l] - h));
+
+        int dice = 0;
+        if (rules.isStandardDice())
+        {
+            dice = rng[l].d3();
+            dice += rng[l].d3();
+        }
+        else
+        {
+            for (int d = 0; d < rules.diceCount; d++)
+                dice += 1 + static_cast<int>(rng[l].below(rules.diceSides));
+        }
+        int distance = std::max(0, dice - h);
+
+        bool goingBack = returning[c][l] | (move[l] == RETURN);
+        uint64_t occupancy = occupied[l] & ~tileBit(p);
+        uint64_t freeTiles = ~occupancy & tilesBelow(size);
+        int row = std::min(std::max(distance, 1), MoveTables::MAX_DISTANCE) - 1;
+
+        int from = std::max(0, std::min(p, size - 1));
+        int ahead = moveTables.forward[row][(freeTiles >> from) & MoveTables::WINDOW_MASK];
+        int behind = moveTables.backward[row][((freeTiles >> std::max(p - MoveTables::WINDOW - 1, 0))
+                                               << std::max(MoveTables::WINDOW + 1 - p, 0)) &
+                                              MoveTables::WINDOW_MASK];
+
+        int target = blend(goingBack, blend(behind != 0, p - behind, 0), from + ahead);
+        bool turned = !goingBack & (target == size);
+        bool tableMiss = goingBack ? (behind == 0) & (p > MoveTables::WINDOW + 1) : ahead == 0;
+        tableMiss |= distance > MoveTables::MAX_DISTANCE; // only under custom dice
+
+        if ((distance > 0) & tableMiss)
+        {
+            bool isReturning = goingBack;
+            target = Board::destination(occupancy, size, p, distance, isReturning);
+            turned = isReturning & !goingBack;
+        }
+
+        target = blend(distance > 0, target, p);
+        turned &= distance > 0;
+
+        position[c][l] = static_cast<uint8_t>(target);
+        returning[c][l] = goingBack | turned;
+        safe[l] += target == 0; // only a returning diver reaches the submarine
+        occupied[l] = occupancy | tileBit(target);
+        lastPlayer[l] = static_cast<int8_t>(blend((move[l] == RETURN) & (target == 0), c, int(lastPlayer[l])));
+    }
+
+    // COLLECT_TREASURE
+    for (int l = 0; l < lanes; l++)
+    {
+        int c = cur[l];
+        int h = held[l];
+        bool take = move[l] == COLLECT_TREASURE;
+        int tile = std::max(pos[l] - 1, 0);
+        int slot = std::min(h, MAX_INVENTORY - 1);
+        uint8_t code = tiles[tile][l];
+        inventory[c][slot][l] = blend(take, code, inventory[c][slot][l]);
+        tiles[tile][l] = blend(take, uint8_t(0), code);
+        flipped[l] |= uint64_t(take) << tile;
+        carried[c][l] = static_cast<uint8_t>(h + take);
+        newPos[l] = position[c][l];
+    }
+
+    for (int l = 0; l < lanes; l++)
+        if (move[l] == DROP_TREASURE)
+            dropStack(l, cur[l], pos[l]);
+
+    for (int l = 0; l < lanes; l++)
+    {
+        if (isTerminal<N>(l))
+        {
+            endRound<N>(l);
+            continue;
+        }
+
+        bool passes = (newPos[l] == 0) | (move[l] > RETURN);
+        int next = blend(cur[l] + 1 == seats<N>(), 0, cur[l] + 1);
+        current[l] = static_cast<int8_t>(blend(passes, next, cur[l]));
+        moved[l] = !passes;
+
+        if (++steps[l] >= MAX_STEPS)
+            finish<N>(l);
+    }
+}
+
+// DROP_TREASURE: the stack with the lowest level sum lands on the blank tile
+void BatchRollout::dropStack(int l, int player, int pos)
+{
+    int stacks = carried[player][l];
+    int minIndex = 0;
+    int minValue = 5;
+    for (int i = 0; i < stacks; i++)
+    {
+        int sum = TreasureStack::fromCode(inventory[player][i][l]).levelSum();
+
+        if (sum < minValue)
+        {
+            minValue = sum;
+            minIndex = i;
+        }
+    }
+
+    if (pos > 0 && pos <= tileCount[l])
+    {
+        tiles[pos - 1][l] = inventory[player][minIndex][l];
+        flipped[l] &= ~tileBit(pos);
+    }
+
+    for (int i = minIndex; i + 1 < stacks; i++)
+        inventory[player][i][l] = inventory[player][i + 1][l];
+    carried[player][l]--;
+}
+
+template <int N>
+bool BatchRollout::isTerminal(int l) const
+{
+    return (safe[l] == seats<N>()) | (oxygen[l] == 0);
+}
+
+template <int N>
+void BatchRollout::endRound(int l)
+{
+    scoreRound<N>(l);
+    if (round[l] >= rules.rounds - 1)
+    {
+        finish<N>(l);
+        return;
+    }
+
+    nextRound<N>(l);
+    moved[l] = false;
+}
+
+template <int N>
+void BatchRollout::finish(int l)
+{
+    if (game[l] >= 0)
+        record<N>(l);
+
+    start<N>(l);
+}
+
+template <int N>
+void BatchRollout::record(int l)
+{
+    for (int p = 0; p < MAX_PLAYERS; p++)
+        scores[game[l]][p] = p < seats<N>() ? points[p][l] : 0.0;
+}
+
+// State::scoreRound: divers outside the submarine drown, the rest cash in their stacks
+template <int N>
+void BatchRollout::scoreRound(int l)
+{
+    for (int p = 0; p < seats<N>(); p++)
+    {
+        if (position[p][l] != 0)
+            dead[p][l] = true;
+
+        if (dead[p][l])
+            continue;
+
+        for (int i = 0; i < carried[p][l]; i++)
+        {
+            uint8_t code = inventory[p][i][l];
+            double sum = 0;
+            for (int c = 0; c < chipCount(code); c++)
+            {
+                int level = chipAt(code, c);
+                switch (valuation)
+                {
+                case ValuationPolicy::EXACT_DRAW:
+                    sum += pools[l].draw(level, rng[l]);
+                    break;
+                case ValuationPolicy::MIDPOINT:
+                    sum += VALUES_PER_LEVEL * level + 2;
+                    break;
+                case ValuationPolicy::EXPECTED_VALUE:
+                    sum += pools[l].expectedValue(level);
+                    break;
+                }
+            }
+            points[p][l] += sum;
+        }
+    }
+}
+
+// the rest of State::reset: compact the path, sink the drowned divers' chips, start over
+template <int N>
+void BatchRollout::nextRound(int l)
+{
+    int kept = 0;
+    for (int i = 0; i < tileCount[l]; i++)
+        if (!(flipped[l] & tileBit(i + 1)))
+            tiles[kept++][l] = tiles[i][l];
+
+    uint8_t loot[MAX_PLAYERS * MAX_INVENTORY * MAX_STACK_CHIPS];
+    int lootCount = 0;
+    for (int p = 0; p < seats<N>(); p++)
+    {
+        if (position[p][l] == 0)
+            continue;
+
+        for (int i = 0; i < carried[p][l]; i++)
+        {
+            uint8_t code = inventory[p][i][l];
+            for (int c = 0; c < chipCount(code); c++)
+                loot[lootCount++] = static_cast<uint8_t>(chipAt(code, c));
+        }
+    }
+
+    while (lootCount > 0)
+    {
+        uint8_t code = 0;
+        while (chipCount(code) < MAX_STACK_CHIPS && lootCount > 0)
+            code = pushChip(code, loot[--lootCount]);
+        tiles[kept++][l] = code;
+    }
+
+    tileCount[l] = static_cast<uint8_t>(kept);
+    flipped[l] = 0;
+    occupied[l] = 0;
+    safe[l] = 0;
+    pools[l].reset(rules.copiesPerValue());
+
+    for (int p = 0; p < seats<N>(); p++)
+    {
+        position[p][l] = 0;
+        returning[p][l] = false;
+        dead[p][l] = false;
+        carried[p][l] = 0;
+    }
+
+    oxygen[l] = static_cast<int8_t>(rules.oxygen);
+    round[l]++;
+    current[l] = lastPlayer[l];
+}
@@ -0,0 +1,134 @@
+#ifndef BATCH_ROLLOUT_HPP
+#define BATCH_ROLLOUT_HPP
+
+#include <array>
+#include "environment.hpp"
+
+constexpr int ROLLOUT_LANES = 16; // games advanced in lockstep
+
+using ScoreVector = std::array<double, MAX_PLAYERS>; // final points of every seat
+
+enum class RolloutPolicy : uint8_t
+{
+    UNIFORM,  // every legal move equally likely
+    CAUTIOUS, // as UNIFORM, but never a third stack or one the oxygen cannot bring home
+};
+
+/**
+ * Plays uniformly random rollouts of one position, ROLLOUT_LANES games at a time.
+ *
+ * Every game lives in a lane of struct-of-arrays storage (one small array per field,
+ * indexed by lane, treasure stacks packed into a byte) and every sweep advances each
+ * lane by one decision, phase by phase across all lanes. The common decisions are
+ * branch-free, so lanes in different stages of their games neither stall each other on
+ * mispredictions nor serialise; drops, bounces off the bottom and round ends take a
+ * scalar path. A lane whose game ends is refilled with the next rollout. No hash or
+ * undo bookkeeping is done.
+ *
+ * Rollout i draws only from its own stream, RNG(rng.next()) taken in order, exactly as
+ * a scalar playout over State would: a move is picked with below(#moves) when the policy
+ * leaves more than one, then State::applyMove rolls the dice and values the chips. A lane
+ * therefore reproduces that playout move for move.
+ */
+class BatchRollout
+{
+public:
+    explicit BatchRollout(RolloutPolicy policy = RolloutPolicy::UNIFORM)
+        : policy(policy)
+    {
+    }
+
+    // scores[i] receives the final points of rollout i
+    void run(const State &state, bool movedThisTurn, int count, RNG &rng, ScoreVector *scores);
+
+    // as run(), with firstMove played instead of a random first decision
+    void runAfter(const State &state, bool movedThisTurn, MoveType firstMove, int count, RNG &rng,
+                  ScoreVector *scores);
+
+    // false falls back to the kernels that read the player count at run time; the timing
+    // benchmark uses it to measure what the per-count instantiations buy
+    void setSpecialized(bool enabled)
+    {
+        specialized = enabled;
+    }
+
+private:
+    static constexpr int L = ROLLOUT_LANES;
+    static constexpr int ROOT = L; // extra column holding the starting position
+    static constexpr int COLUMNS = L + 1;
+
+    RolloutPolicy policy;
+    bool specialized = true;
+
+    // the call being served
+    int numPlayers = 0;
+    ValuationPolicy valuation = ValuationPolicy::MIDPOINT;
+    RulesConfig rules;
+    int forced = -1;
+    int count = 0;
+    int started = 0;
+    int lanes = 0; // lanes in use, fewer than L for small batches
+    RNG *stream = nullptr;
+    ScoreVector *scores = nullptr;
+
+    // game state, one column per lane
+    uint8_t position[MAX_PLAYERS][COLUMNS]{};
+    uint8_t returning[MAX_PLAYERS][COLUMNS]{};
+    uint8_t dead[MAX_PLAYERS][COLUMNS]{};
+    uint8_t carried[MAX_PLAYERS][COLUMNS]{}; // stacks in the inventory
+    uint8_t inventory[MAX_PLAYERS][MAX_INVENTORY][COLUMNS]{};
+    double points[MAX_PLAYERS][COLUMNS]{};
+
+    uint8_t tiles[MAX_TILES][COLUMNS]{}; // packed stack lying on each tile, 0 when blank
+    uint8_t tileCount[COLUMNS]{};
+    uint64_t flipped[COLUMNS]{};
+    uint64_t occupied[COLUMNS]{};
+
+    int8_t oxygen[COLUMNS]{};
+    int8_t round[COLUMNS]{};
+    int8_t current[COLUMNS]{};
+    int8_t lastPlayer[COLUMNS]{};
+    uint8_t moved[COLUMNS]{};
+    uint8_t safe[COLUMNS]{}; // divers dead or back in the submarine
+    ValuePools pools[COLUMNS];
+
+    // bookkeeping of the rollout occupying each lane
+    RNG rng[L];
+    int game[L]{};       // rollout index, -1 once the lane only replays the root
+    int8_t pending[L]{}; // forced first move, -1 once played
+    int steps[L]{};
+
+    void batch(const State &state, bool movedThisTurn, int forcedMove, int rollouts, RNG &rngStream,
+               ScoreVector *out);
+    void load(const State &state, bool movedThisTurn);
+    void dropStack(int lane, int player, int pos);
+
+    // The per-lane kernels are instantiated for N = 2..6 players, so their loops over the
+    // seats have a constant trip count; N = 0 reads numPlayers instead.
+    template <int N>
+    int seats() const
+    {
+        return N > 0 ? N : numPlayers;
+    }
+
+    template <int N>
+    void drive();
+    template <int N>
+    void start(int lane);
+    template <int N>
+    void sweep();
+    template <int N>
+    bool isTerminal(int lane) const;
+    template <int N>
+    void endRound(int lane);
+    template <int N>
+    void finish(int lane);
+    template <int N>
+    void record(int lane);
+    template <int N>
+    void scoreRound(int lane);
+    template <int N>
+    void nextRound(int lane);
+};
+
+#endif // BATCH_ROLLOUT_HPP
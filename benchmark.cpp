@@ -4,8 +4,17 @@
 #include <numeric>
 #include <cmath>
 #include <algorithm>
+#include <cstdlib>
+#include <random>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <functional>
+#include <memory>
 #include "environment.hpp"
 #include "pure_mcts.hpp"
+#include "parallel_mcts.hpp"
 #include "heuristic_bot.hpp"
 
 // Player types: 0 = Pure MCTS, 1 = Heuristic Bot
@@ -16,7 +25,7 @@ struct GameResult
     int winner; // 0 = MCTS, 1 = Heuristic, 2 = Tie
 };
 
-MoveType getAIMove(State &state, int playerNum, int numPlayers, bool movedThisTurn,
+MoveType getAIMove(const State &state, int playerNum, int numPlayers, bool movedThisTurn,
                    PureMCTS &mcts, HeuristicBot &heuristic, int playerType)
 {
     if (playerType == 0)
@@ -31,21 +40,9 @@ MoveType getAIMove(State &state, int playerNum, int numPlayers, bool movedThisTu
     }
 }
 
-GameResult runGame(int mctsPlayerIndex, int heuristicPlayerIndex, int rollouts)
+// Plays state to the end of its last round, asking choose(state, player, movedThisTurn) for every decision
+void playGame(State &state, const std::function<MoveType(const State &, int, bool)> &choose)
 {
-    const int numPlayers = 2;
-    Tile::resetValuePools();
-
-    State state(numPlayers);
-
-    // Player types: mctsPlayerIndex gets MCTS (0), heuristicPlayerIndex gets Heuristic (1)
-    std::vector<int> playerTypes(numPlayers);
-    playerTypes[mctsPlayerIndex] = 0;
-    playerTypes[heuristicPlayerIndex] = 1;
-
-    PureMCTS mcts(numPlayers, rollouts);
-    HeuristicBot heuristic(numPlayers);
-
     while (true)
     {
         int currentP = state.getCurrentPlayerIndex();
@@ -67,7 +64,7 @@ GameResult runGame(int mctsPlayerIndex, int heuristicPlayerIndex, int rollouts)
             continue;
         }
 
-        std::vector<MoveType> moves = state.getPossibleMoves(false);
+        MoveList moves = state.getPossibleMoves(false);
 
         if (moves.empty())
         {
@@ -82,8 +79,7 @@ GameResult runGame(int mctsPlayerIndex, int heuristicPlayerIndex, int rollouts)
         }
 
         // Get AI move (first move - continue/return decision)
-        MoveType chosenMove = getAIMove(state, currentP, numPlayers, false,
-                                        mcts, heuristic, playerTypes[currentP]);
+        MoveType chosenMove = choose(state, currentP, false);
 
         int oldRound = state.getCurrentRound();
         state = state.doMove(chosenMove);
@@ -98,16 +94,37 @@ GameResult runGame(int mctsPlayerIndex, int heuristicPlayerIndex, int rollouts)
         // Second decision (treasure collection/drop)
         if (state.getPlayers()[currentP].getPosition() > 0 && !roundReset)
         {
-            std::vector<MoveType> actions = state.getPossibleMoves(true);
+            MoveList actions = state.getPossibleMoves(true);
 
             if (!actions.empty() && actions[0] != END)
             {
-                MoveType chosenAction = getAIMove(state, currentP, numPlayers, true,
-                                                  mcts, heuristic, playerTypes[currentP]);
+                MoveType chosenAction = choose(state, currentP, true);
                 state = state.doMove(chosenAction);
             }
         }
     }
+}
+
+// The game's dice and the engine's rollouts both come from seed, so a seed replays the game exactly
+GameResult runGame(int mctsPlayerIndex, int heuristicPlayerIndex, int rollouts, ValuationPolicy valuation,
+                   uint64_t seed)
+{
+    const int numPlayers = 2;
+    RNG dice(seed);
+    State state(numPlayers);
+    state.setRng(&dice);
+
+    // Player types: mctsPlayerIndex gets MCTS (0), heuristicPlayerIndex gets Heuristic (1)
+    std::vector<int> playerTypes(numPlayers);
+    playerTypes[mctsPlayerIndex] = 0;
+    playerTypes[heuristicPlayerIndex] = 1;
+
+    PureMCTS mcts(numPlayers, rollouts, valuation);
+    mcts.setRng(dice.split());
+    HeuristicBot heuristic(numPlayers);
+
+    playGame(state, [&](const State &current, int player, bool movedThisTurn)
+             { return getAIMove(current, player, numPlayers, movedThisTurn, mcts, heuristic, playerTypes[player]); });
 
     // Get final scores
     GameResult result;
@@ -124,10 +141,118 @@ GameResult runGame(int mctsPlayerIndex, int heuristicPlayerIndex, int rollouts)
     return result;
 }
 
+// ParallelMCTS with one tree per thread against ParallelMCTS with one shared tree, at the same
+// total iterations per move. rootPlayerIndex gets ParallelMode::ROOT, the other seat TREE.
+GameResult runModeGame(int rootPlayerIndex, int threads, int iterations, uint64_t seed)
+{
+    const int numPlayers = 2;
+    RNG dice(seed);
+    State state(numPlayers);
+    state.setRng(&dice);
+
+    std::vector<std::unique_ptr<ParallelMCTS>> engines;
+    for (int p = 0; p < numPlayers; p++)
+    {
+        engines.push_back(std::make_unique<ParallelMCTS>(numPlayers, iterations, 1.41, threads));
+        engines[p]->setRng(dice.split());
+        engines[p]->setMode(p == rootPlayerIndex ? ParallelMode::ROOT : ParallelMode::TREE);
+    }
+
+    playGame(state, [&](const State &current, int player, bool movedThisTurn)
+             { return engines[player]->findBestMove(current, player, movedThisTurn); });
+
+    // reported as mcts = ROOT, heuristic = TREE
+    GameResult result;
+    result.mctsScore = state.getPlayers()[rootPlayerIndex].getPoints();
+    result.heuristicScore = state.getPlayers()[1 - rootPlayerIndex].getPoints();
+    result.winner = result.mctsScore > result.heuristicScore ? 0 : result.heuristicScore > result.mctsScore ? 1 : 2;
+
+    return result;
+}
+
+// numGames ROOT vs TREE games, seats alternating, at 1, 2, 4 ... maxThreads search threads.
+// Every thread count replays the same seeds, so the rows differ only in the engines.
+void runModeMatch(int numGames, int iterations, int maxThreads, uint64_t seed)
+{
+    std::cout << "Running " << numGames << " games per thread count: Parallel MCTS ROOT vs TREE\n";
+    std::cout << "Iterations per move: " << iterations << ", seed: " << seed << "\n";
+    std::cout << "=========================================================\n\n";
+    std::cout << "Threads |   ROOT wins   |   TREE wins   |     Ties      | ROOT avg | TREE avg |  Time\n";
+
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < maxThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(maxThreads);
+
+    for (int threads : threadCounts)
+    {
+        int wins[3] = {0, 0, 0};
+        double rootTotal = 0.0, treeTotal = 0.0;
+        auto startTime = std::chrono::steady_clock::now();
+
+        for (int game = 0; game < numGames; game++)
+        {
+            GameResult result = runModeGame(game % 2, threads, iterations, seed + game);
+            wins[result.winner]++;
+            rootTotal += result.mctsScore;
+            treeTotal += result.heuristicScore;
+        }
+
+        double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        std::cout << std::setw(7) << threads << std::fixed << std::setprecision(1);
+        for (int w = 0; w < 3; w++)
+            std::cout << " | " << std::setw(4) << wins[w] << " (" << std::setw(5) << (100.0 * wins[w] / numGames) << "%)";
+        std::cout << std::setprecision(2)
+                  << " | " << std::setw(8) << rootTotal / numGames
+                  << " | " << std::setw(8) << treeTotal / numGames
+                  << " | " << std::setw(6) << elapsedSeconds << " s\n";
+    }
+}
+
+bool parseValuation(const std::string &name, ValuationPolicy &valuation)
+{
+    if (name == "exact")
+        valuation = ValuationPolicy::EXACT_DRAW;
+    else if (name == "midpoint")
+        valuation = ValuationPolicy::MIDPOINT;
+    else if (name == "expected")
+        valuation = ValuationPolicy::EXPECTED_VALUE;
+    else
+        return false;
+
+    return true;
+}
+
+void printGame(int game, int numGames, const GameResult &result)
+{
+    int mctsPlayerIndex = game % 2;
+    int heuristicPlayerIndex = 1 - mctsPlayerIndex;
+
+    std::cout << "Game " << std::setw(3) << (game + 1) << "/" << numGames;
+    std::cout << " (PureMCTS=P" << (mctsPlayerIndex + 1) << ", Heuristic=P" << (heuristicPlayerIndex + 1) << ")";
+    std::cout << " | PureMCTS: " << std::setw(3) << result.mctsScore;
+    std::cout << " | Heuristic: " << std::setw(3) << result.heuristicScore;
+    std::cout << " | Winner: ";
+    if (result.winner == 0)
+        std::cout << "PureMCTS";
+    else if (result.winner == 1)
+        std::cout << "Heuristic";
+    else
+        std::cout << "Tie";
+    std::cout << "\n";
+}
+
 int main(int argc, char *argv[])
 {
     int numGames = 100;
     int rollouts = 1000;
+    int numThreads = 1;
+    uint64_t seed = (uint64_t(std::random_device{}()) << 32) | std::random_device{}();
+    std::string valuationName = "midpoint";
+    ValuationPolicy valuation = ValuationPolicy::MIDPOINT;
+    bool modeMatch = false;
+    int iterations = 2000;
 
     for (int i = 1; i < argc; i++)
     {
@@ -136,20 +261,50 @@ int main(int argc, char *argv[])
             numGames = std::atoi(argv[++i]);
         else if (arg == "--rollouts" && i + 1 < argc)
             rollouts = std::atoi(argv[++i]);
+        else if (arg == "--threads" && i + 1 < argc)
+            numThreads = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--seed" && i + 1 < argc)
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--modes")
+            modeMatch = true;
+        else if (arg == "--iterations" && i + 1 < argc)
+            iterations = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--valuation" && i + 1 < argc)
+        {
+            valuationName = argv[++i];
+            if (!parseValuation(valuationName, valuation))
+            {
+                std::cerr << "Unknown valuation policy: " << valuationName << "\n";
+                return 1;
+            }
+        }
         else if (arg == "--help")
         {
             std::cout << "Usage: " << argv[0] << " [options]\n"
-                      << "  --games N     Number of games to play (default: 100)\n"
-                      << "  --rollouts N  Rollouts per move for Pure MCTS (default: 1000)\n";
+                      << "  --games N        Number of games to play (default: 100)\n"
+                      << "  --rollouts N     Rollouts per move for Pure MCTS (default: 1000)\n"
+                      << "  --threads N      Games played concurrently (default: 1)\n"
+                      << "  --seed S         Seed for dice and rollouts; game g uses S + g (default: random)\n"
+                      << "  --valuation P    Rollout treasure valuation: exact, midpoint or expected (default: midpoint)\n"
+                      << "  --modes          Play Parallel MCTS ROOT vs TREE instead, at 1, 2, 4 ... --threads\n"
+                      << "                   search threads; TREE searches with several threads do not replay exactly\n"
+                      << "  --iterations N   Total iterations per move for --modes (default: 2000)\n";
             return 0;
         }
     }
 
+    if (modeMatch)
+    {
+        runModeMatch(numGames, iterations, numThreads, seed);
+        return 0;
+    }
+
     std::cout << "Running " << numGames << " games: Pure MCTS vs Heuristic Bot\n";
-    std::cout << "Pure MCTS rollouts per move: " << rollouts << "\n";
+    std::cout << "Pure MCTS rollouts per move: " << rollouts << ", valuation: " << valuationName
+              << ", threads: " << numThreads << ", seed: " << seed << "\n";
     std::cout << "=========================================================\n\n";
 
-    std::vector<GameResult> results;
+    std::vector<GameResult> results(numGames);
     int mctsWins = 0;
     int heuristicWins = 0;
     int ties = 0;
@@ -157,19 +312,45 @@ int main(int argc, char *argv[])
     std::vector<int> mctsScores;
     std::vector<int> heuristicScores;
 
-    for (int game = 0; game < numGames; game++)
+    auto startTime = std::chrono::steady_clock::now();
+
+    if (numThreads == 1)
+    {
+        for (int game = 0; game < numGames; game++)
+        {
+            // Alternate who goes first
+            int mctsPlayerIndex = game % 2;
+            results[game] = runGame(mctsPlayerIndex, 1 - mctsPlayerIndex, rollouts, valuation, seed + game);
+            printGame(game, numGames, results[game]);
+        }
+    }
+    else
     {
-        // Alternate who goes first
-        int mctsPlayerIndex = game % 2;
-        int heuristicPlayerIndex = 1 - mctsPlayerIndex;
+        std::atomic<int> nextGame{0};
+        std::vector<std::thread> workers;
+
+        for (int t = 0; t < numThreads; t++)
+        {
+            workers.emplace_back([&]()
+                                 {
+                for (int game = nextGame++; game < numGames; game = nextGame++)
+                {
+                    int mctsPlayerIndex = game % 2;
+                    results[game] = runGame(mctsPlayerIndex, 1 - mctsPlayerIndex, rollouts, valuation, seed + game);
+                } });
+        }
 
-        std::cout << "Game " << std::setw(3) << (game + 1) << "/" << numGames;
-        std::cout << " (PureMCTS=P" << (mctsPlayerIndex + 1) << ", Heuristic=P" << (heuristicPlayerIndex + 1) << ")";
-        std::cout.flush();
+        for (auto &worker : workers)
+            worker.join();
 
-        GameResult result = runGame(mctsPlayerIndex, heuristicPlayerIndex, rollouts);
-        results.push_back(result);
+        for (int game = 0; game < numGames; game++)
+            printGame(game, numGames, results[game]);
+    }
 
+    double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    for (const GameResult &result : results)
+    {
         mctsScores.push_back(result.mctsScore);
         heuristicScores.push_back(result.heuristicScore);
 
@@ -179,17 +360,6 @@ int main(int argc, char *argv[])
             heuristicWins++;
         else
             ties++;
-
-        std::cout << " | PureMCTS: " << std::setw(3) << result.mctsScore;
-        std::cout << " | Heuristic: " << std::setw(3) << result.heuristicScore;
-        std::cout << " | Winner: ";
-        if (result.winner == 0)
-            std::cout << "PureMCTS";
-        else if (result.winner == 1)
-            std::cout << "Heuristic";
-        else
-            std::cout << "Tie";
-        std::cout << "\n";
     }
 
     // Calculate statistics
@@ -233,7 +403,11 @@ int main(int argc, char *argv[])
     std::cout << "  Heuristic Bot:\n";
     std::cout << "    Average: " << std::fixed << std::setprecision(2) << heuristicAvg << "\n";
     std::cout << "    Std Dev: " << std::fixed << std::setprecision(2) << heuristicStdDev << "\n";
-    std::cout << "    Min/Max: " << heuristicMin << " / " << heuristicMax << "\n";
+    std::cout << "    Min/Max: " << heuristicMin << " / " << heuristicMax << "\n\n";
+
+    std::cout << "TIME:\n";
+    std::cout << "  Total:    " << std::fixed << std::setprecision(2) << elapsedSeconds << " s\n";
+    std::cout << "  Per game: " << std::fixed << std::setprecision(3) << elapsedSeconds / numGames << " s\n";
 
     return 0;
 }
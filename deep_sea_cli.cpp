@@ -1,9 +1,15 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <random>
 #include <iomanip>
 #include <string>
 #include <vector>
+#include <memory>
 #include <limits>
 #include <sstream>
+#include <stdexcept>
 #include "environment.hpp"
 #include "mcts.hpp"
 #include "pure_mcts.hpp"
@@ -12,7 +18,19 @@
 
 // Player types: 0 = Human, 1 = MCTS AI, 2 = Pure MCTS AI, 3 = Parallel MCTS AI, 4 = Heuristic Bot
 std::vector<int> playerTypes;
-std::vector<HeuristicBot *> heuristicBots; // Track heuristic bots for state management
+std::vector<HeuristicBot *> heuristicBots;      // Track heuristic bots for state management
+std::vector<std::unique_ptr<MCTS>> mctsEngines; // kept for the whole game so each search reuses the last tree
+std::vector<std::unique_ptr<ParallelMCTS>> parallelEngines;
+
+// Both streams derive from --seed: one rolls the game's dice, the other seeds every AI engine and Pure MC search
+RNG diceRng;
+RNG aiRng;
+RulesConfig rules;
+size_t transpositionEntries = 0; // transposition table slots for the MCTS engines; 0 keeps plain trees
+int thinkMs = 0;                 // time per AI decision; 0 searches fixed iteration counts instead
+int leafRollouts = 1;            // rollouts per expanded leaf for the Full MCTS players
+int leafWorkers = 1;             // threads sharing those rollouts
+const int TIMED_CAP = 10000000;  // iterations or rollouts a timed search never exceeds
 
 namespace Color
 {
@@ -49,13 +67,13 @@ void printOxygenBar(int oxygen)
     std::cout << "\n  " << Color::BOLD << Color::CYAN << "OXYGEN: " << Color::RESET;
     std::cout << "[";
 
-    for (int i = 0; i < 25; i++)
+    for (int i = 0; i < rules.oxygen; i++)
     {
         if (i < oxygen)
         {
-            if (oxygen > 15)
+            if (oxygen > rules.oxygen * 3 / 5)
                 std::cout << Color::GREEN << "#";
-            else if (oxygen > 7)
+            else if (oxygen > rules.oxygen * 3 / 10)
                 std::cout << Color::YELLOW << "#";
             else
                 std::cout << Color::RED << "#";
@@ -65,13 +83,13 @@ void printOxygenBar(int oxygen)
             std::cout << Color::WHITE << ".";
         }
     }
-    std::cout << Color::RESET << "] " << oxygen << "/25\n";
+    std::cout << Color::RESET << "] " << oxygen << "/" << rules.oxygen << "\n";
 }
 
 void printBoard(State &state, int numPlayers)
 {
     Board &board = state.getBoard();
-    std::vector<Tile> &tiles = board.getTiles();
+    TileList &tiles = board.getTiles();
     int boardSize = static_cast<int>(tiles.size());
 
     std::cout << "\n";
@@ -133,7 +151,7 @@ void printBoard(State &state, int numPlayers)
             color = Color::RESET;
         }
 
-        char symbol = tiles[i].isFlipped() ? 'o' : '*';
+        char symbol = board.isTileFlipped(i + 1) ? 'o' : '*';
         if (level == 4)
         {
             // For level 4 (fallen treasure), show the sum of contained chip levels
@@ -190,7 +208,7 @@ void printBoard(State &state, int numPlayers)
 void printPlayerStatus(State &state, int numPlayers, int currentPlayer)
 {
     std::cout << "  | " << Color::BOLD << "PLAYER STATUS" << Color::RESET
-              << "  (Round " << (state.getCurrentRound() + 1) << "/3) |\n";
+              << "  (Round " << (state.getCurrentRound() + 1) << "/" << rules.rounds << ") |\n";
 
     for (int p = 0; p < numPlayers; p++)
     {
@@ -261,8 +279,9 @@ MoveType getAIMove(State &state, int playerNum, int numPlayers, bool movedThisTu
         std::cout << "\n  " << PLAYER_COLORS[playerNum] << Color::BOLD
                   << "=== AI Player " << (playerNum + 1) << " (MCTS) is thinking... ===" << Color::RESET << "\n";
 
-        MCTS mcts(numPlayers, 10000000); // 50k iterations
-        MoveType bestMove = mcts.findBestMove(state, playerNum, movedThisTurn);
+        MoveType bestMove = thinkMs > 0 ? mctsEngines[playerNum]->findBestMove(state, playerNum, movedThisTurn,
+                                                                              std::chrono::milliseconds(thinkMs))
+                                        : mctsEngines[playerNum]->findBestMove(state, playerNum, movedThisTurn);
 
         std::cout << "  AI chooses: " << moveTypeToString(bestMove) << "\n";
         return bestMove;
@@ -273,8 +292,11 @@ MoveType getAIMove(State &state, int playerNum, int numPlayers, bool movedThisTu
         std::cout << "\n  " << PLAYER_COLORS[playerNum] << Color::BOLD
                   << "=== AI Player " << (playerNum + 1) << " (Pure MC) is thinking... ===" << Color::RESET << "\n";
 
-        PureMCTS pureMcts(numPlayers, 10000); // 10k rollouts per move
-        MoveType bestMove = pureMcts.findBestMove(state, playerNum, movedThisTurn);
+        PureMCTS pureMcts(numPlayers, thinkMs > 0 ? TIMED_CAP : 10000); // 10k rollouts per move
+        pureMcts.setRng(aiRng.split());
+        MoveType bestMove = thinkMs > 0 ? pureMcts.findBestMove(state, playerNum, movedThisTurn,
+                                                                std::chrono::milliseconds(thinkMs))
+                                        : pureMcts.findBestMove(state, playerNum, movedThisTurn);
 
         std::cout << "  AI chooses: " << moveTypeToString(bestMove) << "\n";
         return bestMove;
@@ -285,8 +307,9 @@ MoveType getAIMove(State &state, int playerNum, int numPlayers, bool movedThisTu
         std::cout << "\n  " << PLAYER_COLORS[playerNum] << Color::BOLD
                   << "=== AI Player " << (playerNum + 1) << " (Parallel MCTS) is thinking... ===" << Color::RESET << "\n";
 
-        ParallelMCTS parallelMcts(numPlayers, 200000); // 200k total iterations across threads
-        MoveType bestMove = parallelMcts.findBestMove(state, playerNum, movedThisTurn);
+        MoveType bestMove = thinkMs > 0 ? parallelEngines[playerNum]->findBestMove(state, playerNum, movedThisTurn,
+                                                                                  std::chrono::milliseconds(thinkMs))
+                                        : parallelEngines[playerNum]->findBestMove(state, playerNum, movedThisTurn);
 
         std::cout << "  AI chooses: " << moveTypeToString(bestMove) << "\n";
         return bestMove;
@@ -307,7 +330,7 @@ MoveType getAIMove(State &state, int playerNum, int numPlayers, bool movedThisTu
     return LEAVE_TREASURE;
 }
 
-int getPlayerChoice(std::vector<MoveType> &moves, int playerNum)
+int getPlayerChoice(const MoveList &moves, int playerNum)
 {
     std::cout << "\n  " << PLAYER_COLORS[playerNum] << Color::BOLD
               << "=== Player " << (playerNum + 1) << "'s turn! ===" << Color::RESET << "\n\n";
@@ -340,9 +363,9 @@ void printRoundStart(int round)
 {
     clearScreen();
     std::cout << Color::BOLD << Color::CYAN;
-    std::cout << "  |          ROUND " << (round + 1) << " OF 3              |\n";
+    std::cout << "  |          ROUND " << (round + 1) << " OF " << rules.rounds << "              |\n";
     std::cout << Color::RESET;
-    std::cout << "\n  All divers start at the submarine with 25 oxygen.\n";
+    std::cout << "\n  All divers start at the submarine with " << rules.oxygen << " oxygen.\n";
     std::cout << "  Dive deep, grab treasure, but return before air runs out!\n";
 }
 
@@ -392,9 +415,8 @@ void printGameOver(State &state, int numPlayers)
 
 void runGame(int numPlayers)
 {
-    Tile::resetValuePools();
-
-    State state(numPlayers);
+    State state(numPlayers, rules);
+    state.setRng(&diceRng);
     int lastRound = -1;
 
     while (true)
@@ -460,7 +482,7 @@ void runGame(int numPlayers)
             continue;
         }
 
-        std::vector<MoveType> moves = state.getPossibleMoves(false);
+        MoveList moves = state.getPossibleMoves(false);
 
         if (moves.empty())
         {
@@ -526,7 +548,7 @@ void runGame(int numPlayers)
 
         if (state.getPlayers()[currentP].getPosition() > 0)
         {
-            std::vector<MoveType> actions = state.getPossibleMoves(true);
+            MoveList actions = state.getPossibleMoves(true);
 
             if (!actions.empty() && actions[0] != END)
             {
@@ -585,11 +607,77 @@ void runGame(int numPlayers)
     printGameOver(state, numPlayers);
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+    uint64_t seed = (uint64_t(std::random_device{}()) << 32) | std::random_device{}();
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc)
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--tiles" && i + 1 < argc)
+            rules.boardTiles = std::atoi(argv[++i]);
+        else if (arg == "--oxygen" && i + 1 < argc)
+            rules.oxygen = std::atoi(argv[++i]);
+        else if (arg == "--rounds" && i + 1 < argc)
+            rules.rounds = std::atoi(argv[++i]);
+        else if (arg == "--think" && i + 1 < argc)
+            thinkMs = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--transpositions" && i + 1 < argc)
+            transpositionEntries = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--leaf-rollouts" && i + 1 < argc)
+            leafRollouts = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--leaf-workers" && i + 1 < argc)
+            leafWorkers = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--dice" && i + 1 < argc)
+        {
+            if (std::sscanf(argv[++i], "%dd%d", &rules.diceCount, &rules.diceSides) != 2)
+            {
+                std::cout << "Dice are written as CdS, e.g. 2d3\n";
+                return 1;
+            }
+        }
+        else
+        {
+            std::cout << "Usage: " << argv[0] << " [options]\n"
+                      << "  --seed S    Seed for the dice and the AI players; the same seed and the same\n"
+                      << "              human choices replay the same game (default: random)\n"
+                      << "  --tiles N   Board length, a multiple of 16 up to 64 (default: 32)\n"
+                      << "  --oxygen N  Oxygen at the start of every round (default: 25)\n"
+                      << "  --rounds N  Rounds per game (default: 3)\n"
+                      << "  --dice CdS  C dice with S sides per move (default: 2d3)\n"
+                      << "  --think MS  Give every AI decision MS milliseconds instead of a fixed number\n"
+                      << "              of iterations; timed games do not replay exactly (default: 0)\n"
+                      << "  --transpositions N\n"
+                      << "              Let the MCTS players share nodes between transposing positions\n"
+                      << "              through a table of N slots (default: 0, off); the shared-tree S\n"
+                      << "              players search without one\n"
+                      << "  --leaf-rollouts K\n"
+                      << "              Rollouts the Full MCTS players play from every new leaf (default: 1)\n"
+                      << "  --leaf-workers N\n"
+                      << "              Threads that share out those rollouts (default: 1)\n";
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    try
+    {
+        rules.validate();
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::cout << e.what() << "\n";
+        return 1;
+    }
+
+    diceRng = RNG(seed);
+    aiRng = diceRng.split();
+
     clearScreen();
 
     std::cout << "\n  " << Color::BOLD << "Welcome to Deep Sea Adventure!" << Color::RESET << "\n";
+    std::cout << "  Seed: " << seed << "\n";
     int numPlayers = 0;
     while (numPlayers < 2 || numPlayers > 6)
     {
@@ -610,11 +698,14 @@ int main()
     std::cout << "\n  Configure each player:\n";
     std::cout << "    M = AI (Full MCTS - strong, slow)\n";
     std::cout << "    R = AI (Parallel MCTS - strong, fast)\n";
+    std::cout << "    S = AI (Parallel MCTS on one shared tree)\n";
     std::cout << "    P = AI (Pure MCTS - simple, dumb)\n";
     std::cout << "    B = AI (Heuristic Bot - fast, predictable)\n";
     std::cout << "    H = Human (Complex, probably also dumb)\n\n";
 
     heuristicBots.resize(numPlayers, nullptr);
+    mctsEngines.resize(numPlayers);
+    parallelEngines.resize(numPlayers);
 
     for (int i = 0; i < numPlayers; i++)
     {
@@ -623,9 +714,10 @@ int main()
                typeChar != 'M' && typeChar != 'm' &&
                typeChar != 'P' && typeChar != 'p' &&
                typeChar != 'R' && typeChar != 'r' &&
+               typeChar != 'S' && typeChar != 's' &&
                typeChar != 'B' && typeChar != 'b')
         {
-            std::cout << "  " << PLAYER_COLORS[i] << "Player " << (i + 1) << Color::RESET << " [H/M/R/P/B]: ";
+            std::cout << "  " << PLAYER_COLORS[i] << "Player " << (i + 1) << Color::RESET << " [H/M/R/S/P/B]: ";
             std::cin >> typeChar;
 
             if (std::cin.fail())
@@ -645,13 +737,30 @@ int main()
         else if (typeChar == 'M' || typeChar == 'm')
         {
             playerTypes[i] = 1;
+            mctsEngines[i] = std::make_unique<MCTS>(numPlayers, 10000000);
+            mctsEngines[i]->setRng(aiRng.split());
+            mctsEngines[i]->setTranspositions(transpositionEntries);
+            mctsEngines[i]->setLeafParallelism(leafRollouts, leafWorkers);
             std::cout << "    -> AI (Full MCTS)\n";
         }
         else if (typeChar == 'R' || typeChar == 'r')
         {
             playerTypes[i] = 3;
+            parallelEngines[i] = std::make_unique<ParallelMCTS>(numPlayers, thinkMs > 0 ? TIMED_CAP : 200000); // 200k total iterations across threads
+            parallelEngines[i]->setRng(aiRng.split());
+            parallelEngines[i]->setTranspositions(transpositionEntries);
             std::cout << "    -> AI (Parallel MCTS)\n";
         }
+        else if (typeChar == 'S' || typeChar == 's')
+        {
+            playerTypes[i] = 3;
+            parallelEngines[i] = std::make_unique<ParallelMCTS>(numPlayers, thinkMs > 0 ? TIMED_CAP : 200000);
+            parallelEngines[i]->setRng(aiRng.split());
+            parallelEngines[i]->setMode(ParallelMode::TREE);
+            std::cout << "    -> AI (Parallel MCTS, shared tree)\n";
+            if (transpositionEntries > 0)
+                std::cout << "       (--transpositions applies to root-parallel workers only; ignored here)\n";
+        }
         else if (typeChar == 'P' || typeChar == 'p')
         {
             playerTypes[i] = 2;
@@ -680,5 +789,9 @@ int main()
         }
     }
 
+    // destroyed here rather than after main, so leaf rollout workers are joined while main still runs
+    mctsEngines.clear();
+    parallelEngines.clear();
+
     return 0;
 }
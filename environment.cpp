@@ -1,62 +1,190 @@
 #include <stdexcept>
 #include <algorithm>
+#include <cstring>
+#include <string>
 #include "environment.hpp"
 
-thread_local std::random_device RNG::rd;
-thread_local std::mt19937 RNG::gen(rd());
-std::uniform_int_distribution<int> RNG::dist1(1, 3);
-std::vector<int> Tile::tileValues0 = {0, 0, 1, 1, 2, 2, 3, 3};
-std::vector<int> Tile::tileValues1 = {4, 4, 5, 5, 6, 6, 7, 7};
-std::vector<int> Tile::tileValues2 = {8, 8, 9, 9, 10, 10, 11, 11};
-std::vector<int> Tile::tileValues3 = {12, 12, 13, 13, 14, 14, 15, 15};
-bool Tile::useDeterministicValues = false;
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
 
-template <typename T>
-T pickAndRemoveRandomElement(std::vector<T> &vec)
+void RNG::jump()
 {
-    if (vec.empty())
+    static const uint64_t JUMP[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                    0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+
+    uint64_t t[4] = {0, 0, 0, 0};
+    for (uint64_t word : JUMP)
+        for (int b = 0; b < 64; b++)
+        {
+            if (word & (uint64_t(1) << b))
+                for (int i = 0; i < 4; i++)
+                    t[i] ^= s[i];
+            next();
+        }
+
+    for (int i = 0; i < 4; i++)
+        s[i] = t[i];
+}
+
+RNG RNG::split()
+{
+    RNG stream = *this;
+    jump();
+    return stream;
+}
+
+RNG &RNG::local()
+{
+    thread_local RNG generator = []()
     {
-        throw std::runtime_error("Cannot pick from an empty vector");
-    }
+        std::random_device rd;
+        return RNG((uint64_t(rd()) << 32) ^ rd());
+    }();
+    return generator;
+}
 
-    std::uniform_int_distribution<size_t> dist(0, vec.size() - 1); // pick a random element
-    size_t randomIndex = dist(RNG::gen);
+namespace
+{
+    /**
+     * Random keys for every feature of a position. Unbounded counters
+     * (oxygen, round, points) are hashed with a salted mixer instead of a table.
+     */
+    struct ZobristKeys
+    {
+        uint64_t position[MAX_PLAYERS][MAX_TILES + 1];
+        uint64_t returning[MAX_PLAYERS];
+        uint64_t dead[MAX_PLAYERS];
+        uint64_t inventory[MAX_PLAYERS][MAX_INVENTORY][MAX_STACK_CHIPS][CHIP_LEVELS];
+        uint64_t tileChips[MAX_TILES][MAX_STACK_CHIPS][CHIP_LEVELS];
+        uint64_t flipped[MAX_TILES];
+        uint64_t occupied[MAX_TILES];
+        uint64_t currentPlayer[MAX_PLAYERS];
+        uint64_t lastPlayer[MAX_PLAYERS];
+        uint64_t valuesLeft[CHIP_LEVELS][VALUES_PER_LEVEL][MAX_COPIES_PER_VALUE + 1];
+        uint64_t movedThisTurn;
+        uint64_t oxygenSalt;
+        uint64_t roundSalt;
+        uint64_t pointsSalt[MAX_PLAYERS];
+
+        ZobristKeys()
+        {
+            uint64_t seed = 0x5EAD1BE5D1CEULL;
+            auto fill = [&seed](uint64_t *keys, size_t count)
+            {
+                for (size_t i = 0; i < count; i++)
+                    keys[i] = RNG::splitMix64(seed++);
+            };
+
+            fill(&position[0][0], sizeof(position) / sizeof(uint64_t));
+            fill(returning, MAX_PLAYERS);
+            fill(dead, MAX_PLAYERS);
+            fill(&inventory[0][0][0][0], sizeof(inventory) / sizeof(uint64_t));
+            fill(&tileChips[0][0][0], sizeof(tileChips) / sizeof(uint64_t));
+            fill(flipped, MAX_TILES);
+            fill(occupied, MAX_TILES);
+            fill(currentPlayer, MAX_PLAYERS);
+            fill(lastPlayer, MAX_PLAYERS);
+            fill(&valuesLeft[0][0][0], sizeof(valuesLeft) / sizeof(uint64_t));
+            fill(&movedThisTurn, 1);
+            fill(&oxygenSalt, 1);
+            fill(&roundSalt, 1);
+            fill(pointsSalt, MAX_PLAYERS);
+        }
 
-    T pickedValue = vec[randomIndex]; // save the value
+        uint64_t value(uint64_t salt, int v) const
+        {
+            return RNG::splitMix64(salt ^ static_cast<uint64_t>(static_cast<uint32_t>(v)));
+        }
+
+        uint64_t value(uint64_t salt, double v) const
+        {
+            uint64_t bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            return RNG::splitMix64(salt ^ bits);
+        }
+
+        uint64_t stack(const uint64_t (&chips)[MAX_STACK_CHIPS][CHIP_LEVELS], const TreasureStack &treasure) const
+        {
+            uint64_t key = 0;
+            for (size_t i = 0; i < treasure.size(); i++)
+                key ^= chips[i][treasure[i]];
+            return key;
+        }
 
-    vec[randomIndex] = vec.back(); // move a value from the back in that slot
+        // where a diver stands, including the occupancy bit it sets on that tile
+        uint64_t standing(int player, int position) const
+        {
+            return this->position[player][position] ^ (position > 0 ? occupied[position - 1] : 0);
+        }
+
+        // inventory slots from `first` on
+        uint64_t inventoryFrom(int player, const Inventory &treasures, size_t first) const
+        {
+            uint64_t key = 0;
+            for (size_t slot = first; slot < treasures.size(); slot++)
+                key ^= stack(inventory[player][slot], treasures[slot]);
+            return key;
+        }
+    };
 
-    vec.pop_back(); // remove the value from the back
+    const ZobristKeys zobrist;
+}
 
-    return pickedValue; // return picked value
+// mask with the lowest n bits set, n clamped to [0, 64]
+static inline uint64_t lowBits(int n)
+{
+    if (n <= 0)
+        return 0;
+    return n >= 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
 }
 
+// index of the n-th (0-based) lowest set bit of x; x must have more than n bits set
+static inline int selectBit(uint64_t x, int n)
+{
+#if defined(__BMI2__)
+    return __builtin_ctzll(_pdep_u64(uint64_t(1) << n, x));
+#else
+    for (int i = 0; i < n; i++)
+        x &= x - 1; // drop the lowest set bit
+    return __builtin_ctzll(x);
+#endif
+}
+
+/**
+ * Compacts the path at the end of a round: blank (flipped) tiles are removed
+ * and the remaining tiles slide together. All divers are back in the
+ * submarine, so nothing is occupied afterwards.
+ */
 void Board::updateBoard()
 {
-    std::vector<Tile> newTiles;
-    for (auto tile : tiles)
+    int size = static_cast<int>(tiles.size());
+    uint64_t blanks = flippedMask & lowBits(size);
+    size_t kept = blanks ? __builtin_ctzll(blanks) : size; // tiles before the first blank stay put
+    uint64_t keep = ~blanks & lowBits(size) & ~lowBits(static_cast<int>(kept));
+
+    while (keep)
     {
-        if (!tile.flipped)
-        {
-            if (tile.isOccupied())
-                tile.changeOccupationStatus();
-            newTiles.push_back(tile);
-        }
+        int index = __builtin_ctzll(keep);
+        keep &= keep - 1;
+        tiles[kept++] = tiles[index];
     }
 
-    this->tiles = newTiles;
+    tiles.resize(kept);
+    flippedMask = 0;
+    occupiedMask = 0;
 }
 
 // flip tile when collecting treasure
 void Board::flipTile(int index)
 {
-    if (index > tiles.size())
+    if (index > static_cast<int>(tiles.size()))
         throw std::runtime_error("Out of bounds access in tile list");
 
     if (index == 0)
         return;
 
-    tiles[index - 1].flipped = true;
+    setFlippedAt(index, true);
 }
 
 bool Board::isTileFlipped(int index) const
@@ -65,12 +193,12 @@ bool Board::isTileFlipped(int index) const
         return false;
 
     if (index > static_cast<int>(tiles.size()))
-        return true; // Treat out of bounds as already flipped (no treasure)
+        throw std::runtime_error("Out of bounds access in tile list");
 
-    return tiles[index - 1].flipped;
+    return isFlippedAt(index);
 }
 
-bool Board::isTileOccupied(int index)
+bool Board::isTileOccupied(int index) const
 {
     if (index <= 0)
         return false;
@@ -78,28 +206,216 @@ bool Board::isTileOccupied(int index)
     if (index > static_cast<int>(tiles.size()))
         return false; // Treat out of bounds as unoccupied instead of crashing
 
-    return tiles[index - 1].occupied;
+    return (occupiedMask >> (index - 1)) & 1;
 }
 
-void Tile::resetValuePools()
+namespace
 {
-    tileValues0 = {0, 0, 1, 1, 2, 2, 3, 3};
-    tileValues1 = {4, 4, 5, 5, 6, 6, 7, 7};
-    tileValues2 = {8, 8, 9, 9, 10, 10, 11, 11};
-    tileValues3 = {12, 12, 13, 13, 14, 14, 15, 15};
+    constexpr MoveTables buildMoveTables()
+    {
+        MoveTables tables{};
+        for (uint32_t window = 0; window <= MoveTables::WINDOW_MASK; window++)
+        {
+            int found = 0;
+            for (int offset = 1; offset <= MoveTables::WINDOW && found < MoveTables::MAX_DISTANCE; offset++)
+                if (window & (1u << (offset - 1)))
+                    tables.forward[found++][window] = static_cast<uint8_t>(offset);
+
+            found = 0;
+            for (int offset = 1; offset <= MoveTables::WINDOW && found < MoveTables::MAX_DISTANCE; offset++)
+                if (window & (1u << (MoveTables::WINDOW - offset)))
+                    tables.backward[found++][window] = static_cast<uint8_t>(offset);
+        }
+        return tables;
+    }
+
+    constexpr int MAX_TABLE_DISTANCE = MoveTables::MAX_DISTANCE;
+    constexpr int MOVE_WINDOW = MoveTables::WINDOW;
+    constexpr uint32_t WINDOW_MASK = MoveTables::WINDOW_MASK;
 }
 
-Tile::ValuePoolSnapshot Tile::saveValuePools()
+const MoveTables moveTables = buildMoveTables();
+
+/**
+ * Where a diver standing on `position` ends up after moving `distance` free
+ * tiles. Occupied tiles are skipped without consuming distance. A diver who
+ * reaches the last tile turns around (isReturning is set) and spends what is
+ * left of the distance on the way back; running out of path upwards means
+ * arriving at the submarine (0). The diver's own tile must already be vacated.
+ */
+int Board::destination(uint64_t occupiedMask, int size, int position, int distance, bool &isReturning)
 {
-    return {tileValues0, tileValues1, tileValues2, tileValues3};
+    if (distance <= 0)
+        return position;
+
+    if (distance > MAX_TABLE_DISTANCE)
+        return selectDestination(occupiedMask, size, position, distance, isReturning);
+
+    uint64_t freeTiles = ~occupiedMask & lowBits(size);
+
+    if (!isReturning)
+    {
+        // window bit k is tile start + k + 1; a diver already at the end re-enters the last tile
+        int start = std::max(0, std::min(position, size - 1));
+        uint32_t window = static_cast<uint32_t>(freeTiles >> start) & WINDOW_MASK;
+        int offset = moveTables.forward[distance - 1][window];
+
+        if (offset == 0) // bounces off the bottom
+            return selectDestination(occupiedMask, size, position, distance, isReturning);
+
+        int target = start + offset;
+        if (target == size)
+            isReturning = true;
+        return target;
+    }
+
+    // window bit MOVE_WINDOW - k is tile position - k
+    uint32_t window = position > MOVE_WINDOW
+                          ? static_cast<uint32_t>(freeTiles >> (position - 1 - MOVE_WINDOW)) & WINDOW_MASK
+                          : static_cast<uint32_t>(freeTiles << (MOVE_WINDOW + 1 - position)) & WINDOW_MASK;
+    int offset = moveTables.backward[distance - 1][window];
+
+    if (offset != 0)
+        return position - offset;
+    if (position <= MOVE_WINDOW + 1) // the window reached the submarine
+        return 0;
+    return selectDestination(occupiedMask, size, position, distance, isReturning);
 }
 
-void Tile::restoreValuePools(const ValuePoolSnapshot &snapshot)
+int Board::selectDestination(uint64_t occupiedMask, int size, int position, int distance, bool &isReturning)
 {
-    tileValues0 = snapshot.v0;
-    tileValues1 = snapshot.v1;
-    tileValues2 = snapshot.v2;
-    tileValues3 = snapshot.v3;
+    if (distance <= 0)
+        return position;
+
+    uint64_t freeTiles = ~occupiedMask & lowBits(size);
+
+    if (!isReturning)
+    {
+        if (size == 0)
+        {
+            isReturning = true;
+            return 0;
+        }
+
+        // free tiles beyond the diver; a diver already at the end re-enters the last tile
+        uint64_t ahead = freeTiles & ~lowBits(std::min(position, size - 1));
+        int aheadCount = __builtin_popcountll(ahead);
+
+        if (distance <= aheadCount)
+        {
+            int target = selectBit(ahead, distance - 1) + 1;
+            if (target == size)
+                isReturning = true;
+            return target;
+        }
+
+        // bounce off the bottom of the path and head back up with what is left
+        isReturning = true;
+        distance -= aheadCount;
+        position = size;
+    }
+
+    uint64_t behind = freeTiles & lowBits(position - 1);
+    int behindCount = __builtin_popcountll(behind);
+
+    if (distance > behindCount)
+        return 0;
+
+    return selectBit(behind, behindCount - distance) + 1;
+}
+
+void RulesConfig::validate() const
+{
+    constexpr int VALUES = CHIP_LEVELS * VALUES_PER_LEVEL;
+    if (boardTiles < VALUES || boardTiles > MAX_TILES || boardTiles % VALUES != 0)
+        throw std::runtime_error("Board length must be a multiple of " + std::to_string(VALUES) + " up to " +
+                                 std::to_string(MAX_TILES));
+    if (oxygen < 1 || oxygen > MAX_OXYGEN)
+        throw std::runtime_error("Oxygen must be between 1 and " + std::to_string(MAX_OXYGEN));
+    if (rounds < 1 || rounds > MAX_ROUNDS)
+        throw std::runtime_error("Rounds must be between 1 and " + std::to_string(MAX_ROUNDS));
+    if (diceCount < 1 || diceCount > 4 || diceSides < 1 || diceSides > 6)
+        throw std::runtime_error("Dice must be 1-4 dice of 1-6 sides");
+}
+
+double RulesConfig::rollProbability(int sum) const
+{
+    if (isStandardDice()) // read on every chance node value, so 2d3 is a table lookup
+    {
+        static constexpr double TWO_D3[] = {0, 0, 1 / 9.0, 2 / 9.0, 3 / 9.0, 2 / 9.0, 1 / 9.0};
+        return sum >= 2 && sum <= 6 ? TWO_D3[sum] : 0.0;
+    }
+
+    // ways[s] counts the throws of the dice so far that add up to s
+    int ways[4 * 6 + 1] = {1};
+    for (int d = 0; d < diceCount; d++)
+        for (int s = maxRoll(); s >= 0; s--)
+        {
+            ways[s] = 0;
+            for (int face = 1; face <= diceSides && face <= s; face++)
+                ways[s] += ways[s - face];
+        }
+
+    if (sum < minRoll() || sum > maxRoll())
+        return 0.0;
+
+    int throws = 1;
+    for (int d = 0; d < diceCount; d++)
+        throws *= diceSides;
+    return static_cast<double>(ways[sum]) / throws;
+}
+
+void ValuePools::reset(int copies)
+{
+    for (auto &level : counts)
+        for (auto &count : level)
+            count = static_cast<uint8_t>(copies);
+
+    recount();
+}
+
+void ValuePools::recount()
+{
+    for (int level = 0; level < CHIP_LEVELS; level++)
+    {
+        totals[level] = 0;
+        sums[level] = 0;
+        for (int v = 0; v < VALUES_PER_LEVEL; v++)
+        {
+            totals[level] += counts[level][v];
+            sums[level] += counts[level][v] * (VALUES_PER_LEVEL * level + v);
+        }
+    }
+}
+
+int ValuePools::draw(int level, RNG &rng)
+{
+    uint8_t *pool = counts[level];
+    if (totals[level] == 0)
+    {
+        throw std::runtime_error("Cannot pick from an empty value pool");
+    }
+
+    int pick = static_cast<int>(rng.below(totals[level])); // pick a random chip
+
+    int v = 0;
+    while (pick >= pool[v])
+        pick -= pool[v++];
+
+    pool[v]--;
+    int value = VALUES_PER_LEVEL * level + v;
+    totals[level]--;
+    sums[level] -= value;
+    return value;
+}
+
+bool ValuePools::operator==(const ValuePools &other) const
+{
+    for (int level = 0; level < CHIP_LEVELS; level++)
+        for (int v = 0; v < VALUES_PER_LEVEL; v++)
+            if (counts[level][v] != other.counts[level][v])
+                return false;
+    return true;
 }
 
 /**
@@ -113,7 +429,7 @@ void State::calculatePlayerScores()
         {
             for (auto &treasure : player.getTreasures())
             {
-                player.addPoints(Tile::calculateTreasureValue(treasure));
+                player.addPoints(Tile::calculateTreasureValue(treasure, valuePools, valuation, getRng()));
             }
         }
     }
@@ -125,7 +441,7 @@ void State::calculatePlayerScores()
  */
 void State::redistributeTreasure()
 {
-    TreasureStack allDroppedLoot;
+    FixedVector<uint8_t, MAX_PLAYERS * MAX_INVENTORY * MAX_STACK_CHIPS> allDroppedLoot;
 
     for (auto &player : players) // collect treasure from dead players
     {
@@ -134,7 +450,8 @@ void State::redistributeTreasure()
             auto &pTreasures = player.getTreasures();
 
             for (auto &treasure : pTreasures)
-                allDroppedLoot.insert(allDroppedLoot.end(), treasure.begin(), treasure.end());
+                for (auto chip : treasure)
+                    allDroppedLoot.push_back(chip);
 
             pTreasures.clear();
         }
@@ -146,41 +463,24 @@ void State::redistributeTreasure()
     {
         Tile newTile;
         newTile.level = 4; // Mark as fallen treasure
-        while (newTile.droppedTreasureCount < 3 && !allDroppedLoot.empty())
+        while (newTile.treasure.size() < MAX_STACK_CHIPS && !allDroppedLoot.empty())
         {
             newTile.treasure.push_back(allDroppedLoot.back());
             allDroppedLoot.pop_back();
-            newTile.droppedTreasureCount++;
         }
 
         tiles.push_back(newTile);
     }
 }
 
-bool State::isLastRound() const // meaning third round
+bool State::isLastRound() const
 {
-    return currentRound >= 2;
+    return currentRound >= rules.rounds - 1;
 }
 
 bool State::isTerminal() const // oxygen is 0 or all players reached the submarine
 {
-    if (oxygen == 0)
-    {
-        return true;
-    }
-
-    for (const auto &p : players)
-    { // check if the players are in the submarine
-        if (!p.getIsDead())
-        {
-            if (p.getPosition() > 0 || !p.getIsReturning())
-            {
-                return false;
-            }
-        }
-    }
-
-    return true;
+    return oxygen == 0 || safe == static_cast<int>(players.size());
 }
 
 Player &State::getCurrentPlayer()
@@ -190,151 +490,69 @@ Player &State::getCurrentPlayer()
 
 int State::throwDice()
 {
-    return RNG::dist1(RNG::gen) + RNG::dist1(RNG::gen);
+    return rules.roll(getRng());
 }
 
-int Tile::calculateTreasureValue(TreasureStack stack)
+double Tile::calculateTreasureValue(const TreasureStack &stack, ValuePools &pools, ValuationPolicy policy, RNG &rng)
 {
-    int sum = 0;
-    for (auto treasure : stack)
+    double sum = 0;
+    for (uint8_t treasure : stack) // a packed stack only holds levels 0-3
     {
-        if (useDeterministicValues)
-        {
-            // Use average value for each level during MCTS to avoid pool exhaustion
-            // Level 0: avg of 0-3 = 1.5, Level 1: avg of 4-7 = 5.5, etc.
-            switch (treasure)
-            {
-            case 0:
-                sum += 2; // midpoint of 0-3
-                break;
-            case 1:
-                sum += 6; // midpoint of 4-7
-                break;
-            case 2:
-                sum += 10; // midpoint of 8-11
-                break;
-            case 3:
-                sum += 14; // midpoint of 12-15
-                break;
-            default:
-                throw std::runtime_error("Invalid tile type");
-            }
-        }
-        else
+        switch (policy)
         {
-            switch (treasure)
-            {
-            case 0:
-                sum += pickAndRemoveRandomElement(tileValues0);
-                break;
-            case 1:
-                sum += pickAndRemoveRandomElement(tileValues1);
-                break;
-            case 2:
-                sum += pickAndRemoveRandomElement(tileValues2);
-                break;
-            case 3:
-                sum += pickAndRemoveRandomElement(tileValues3);
-                break;
-            default:
-                throw std::runtime_error("Invalid tile type");
-            }
+        case ValuationPolicy::EXACT_DRAW:
+            sum += pools.draw(treasure, rng);
+            break;
+        case ValuationPolicy::MIDPOINT:
+            // Level 0: 0-3 scores 2, Level 1: 4-7 scores 6, etc.
+            sum += VALUES_PER_LEVEL * treasure + 2;
+            break;
+        case ValuationPolicy::EXPECTED_VALUE:
+            // the pool is left untouched: removing a random chip does not change its mean
+            sum += pools.expectedValue(treasure);
+            break;
         }
     }
 
     return sum;
 }
 
-void Player::getTreasure(Tile &tile) // collects treasure from a tile and calculates its value
-{
-    tile.flip();
-
-    TreasureStack new_treasures;
-
-    for (auto treasure : tile.treasure)
-    {
-        new_treasures.push_back(treasure);
-    }
-
-    // Only add tile level if it's a regular tile (0-3), not a fallen treasure tile (4)
-    if (tile.level < 4)
-    {
-        new_treasures.push_back(tile.level);
-    }
-
-    this->inventory.push_back(new_treasures);
-}
-
-void Tile::changeOccupationStatus()
+void Player::getTreasure(Tile &tile) // takes every chip lying on the tile, leaving a blank space behind
 {
-    this->occupied = !this->occupied;
+    this->inventory.push_back(tile.treasure);
+    tile.treasure.clear();
 }
 
 void Player::move(int distance, Board &board)
 {
-    distance = std::max<int>(0, distance - inventory.size());
-    auto &tiles = board.getTiles();
+    distance = std::max<int>(0, distance - static_cast<int>(inventory.size()));
 
-    if (this->position > 0 && this->position <= static_cast<int>(tiles.size()))
-        tiles[this->position - 1].changeOccupationStatus();
-
-    while (distance > 0)
-    {
-        if (isReturning)
-        {
-            this->position -= 1;
-
-            if (this->position <= 0)
-            {
-                this->position = 0;
-                distance--; // Moving to submarine consumes distance
-                break;      // Reached submarine
-            }
-
-            // Only consume distance if the tile we landed on is not occupied
-            if (!board.isTileOccupied(this->position))
-                distance--;
-        }
-        else
-        {
-            this->position += 1;
-            if (this->position >= static_cast<int>(tiles.size()))
-            {
-                this->position = static_cast<int>(tiles.size());
-                isReturning = true;
-            }
-
-            // Only consume distance if the tile we landed on is not occupied
-            if (!board.isTileOccupied(this->position))
-                distance--;
-        }
-    }
-
-    if (this->position > 0 && this->position <= static_cast<int>(tiles.size()))
-        tiles[this->position - 1].changeOccupationStatus();
+    board.toggleOccupied(this->position); // leave the current tile
+    this->position = board.destination(this->position, distance, this->isReturning);
+    board.toggleOccupied(this->position);
 }
 
-std::vector<MoveType> State::getPossibleMoves(bool movedThisTurn) const
+MoveList State::getPossibleMoves(bool movedThisTurn) const
 {
-    std::vector<MoveType> result;
+    MoveList result;
 
     if (isTerminal())
     {
-        result.push_back({END});
+        result.push_back(END);
 
         return result;
     }
 
-    Player currentPlayerCopy = players[currentPlayer];
+    const Player &currentPlayerRef = players[currentPlayer];
 
     if (!movedThisTurn) // move this turn
     {
-        if (currentPlayerCopy.getPosition() == 0 && currentPlayerCopy.getIsReturning())
+        if (currentPlayerRef.getPosition() == 0 && currentPlayerRef.getIsReturning())
         {
             result.push_back(LEAVE_TREASURE);
             return result; // went back to the submarine, no options left, stay there
         }
-        if (currentPlayerCopy.getIsReturning()) // if you decide to return you can move in only one direction
+        if (currentPlayerRef.getIsReturning()) // if you decide to return you can move in only one direction
         {
             result.push_back(RETURN);
         }
@@ -342,8 +560,8 @@ std::vector<MoveType> State::getPossibleMoves(bool movedThisTurn) const
         {
             result.push_back(CONTINUE);
 
-            if (currentPlayerCopy.getTreasures().size() > 0 ||
-                currentPlayerCopy.getPosition() >= (int)board.getTiles().size()) // can return with treasure OR at end tile
+            if (currentPlayerRef.getTreasures().size() > 0 ||
+                currentPlayerRef.getPosition() >= (int)board.getTiles().size()) // can return with treasure OR at end tile
                 result.push_back(RETURN);                                        // decide to return
         }
 
@@ -351,16 +569,16 @@ std::vector<MoveType> State::getPossibleMoves(bool movedThisTurn) const
     }
 
     // if we reached this point, then the choice is simply between collecting a treasure or not
-    if (currentPlayerCopy.getPosition() <= board.getTiles().size() &&
-        currentPlayerCopy.getPosition() != 0 &&
-        !board.isTileFlipped(currentPlayerCopy.getPosition())) // can collect treasure
+    if (currentPlayerRef.getPosition() <= static_cast<int>(board.getTiles().size()) &&
+        currentPlayerRef.getPosition() != 0 &&
+        !board.isFlippedAt(currentPlayerRef.getPosition())) // can collect treasure
     {
         result.push_back(COLLECT_TREASURE);
     }
 
-    if (currentPlayerCopy.getTreasures().size() > 0 &&
-        currentPlayerCopy.getPosition() != 0 &&
-        board.isTileFlipped(currentPlayerCopy.getPosition()))
+    if (currentPlayerRef.getTreasures().size() > 0 &&
+        currentPlayerRef.getPosition() != 0 &&
+        board.isFlippedAt(currentPlayerRef.getPosition()))
     {
         result.push_back(DROP_TREASURE);
     }
@@ -378,65 +596,192 @@ void Player::reset()
     this->inventory.clear();
 }
 
+/**
+ * Ends the round: players who did not reach the submarine drown,
+ * everyone else cashes in the treasure they carried back.
+ */
+void State::scoreRound()
+{
+    for (auto &player : players)
+    {
+        if (player.getPosition() != 0) // kill all players that did not reach the submarine
+            player.setIsDead();
+    }
+
+    calculatePlayerScores(); // add the captured treasures to the player score
+}
+
 void State::reset()
 {
-    this->board.updateBoard();
+    scoreRound();
 
-    // Note: calculatePlayerScores() is called in doMove() before reset()
-    // so we don't need to call it again here
+    this->board.updateBoard();
 
     redistributeTreasure();
 
     // Reset value pools for the new round
-    Tile::resetValuePools();
+    valuePools.reset(rules.copiesPerValue());
 
     for (auto &player : players)
     {
         player.reset();
     }
 
-    this->oxygen = 25;
+    this->oxygen = rules.oxygen;
     this->currentRound++;
     this->currentPlayer = this->lastPlayer; // last one to arrive at submarine plays first
+
+    rehash(); // everything changed hands, recompute instead of tracking
+}
+
+uint64_t State::getHash(bool movedThisTurn) const
+{
+    return movedThisTurn ? hash ^ zobrist.movedThisTurn : hash;
+}
+
+uint64_t State::computeHash(bool movedThisTurn) const
+{
+    uint64_t key = movedThisTurn ? zobrist.movedThisTurn : 0;
+
+    for (int p = 0; p < static_cast<int>(players.size()); p++)
+    {
+        const Player &player = players[p];
+        key ^= zobrist.position[p][player.position];
+        key ^= player.isReturning ? zobrist.returning[p] : 0;
+        key ^= player.isDead ? zobrist.dead[p] : 0;
+        key ^= zobrist.inventoryFrom(p, player.inventory, 0);
+        key ^= zobrist.value(zobrist.pointsSalt[p], player.points);
+    }
+
+    const TileList &tiles = board.getTiles();
+    for (size_t i = 0; i < tiles.size(); i++)
+        key ^= zobrist.stack(zobrist.tileChips[i], tiles[i].treasure);
+
+    uint64_t onBoard = lowBits(static_cast<int>(tiles.size()));
+    for (uint64_t m = board.getFlippedMask() & onBoard; m; m &= m - 1)
+        key ^= zobrist.flipped[__builtin_ctzll(m)];
+    for (uint64_t m = board.getOccupiedMask() & onBoard; m; m &= m - 1)
+        key ^= zobrist.occupied[__builtin_ctzll(m)];
+
+    key ^= zobrist.value(zobrist.oxygenSalt, oxygen);
+    key ^= zobrist.value(zobrist.roundSalt, currentRound);
+    key ^= zobrist.currentPlayer[currentPlayer];
+    key ^= zobrist.lastPlayer[lastPlayer];
+
+    for (int level = 0; level < CHIP_LEVELS; level++)
+        for (int v = 0; v < VALUES_PER_LEVEL; v++)
+            key ^= zobrist.valuesLeft[level][v][valuePools.remaining(level, VALUES_PER_LEVEL * level + v)];
+
+    return key;
+}
+
+void State::rehash()
+{
+    hash = computeHash(false);
+
+    safe = 0;
+    for (const auto &player : players)
+        safe += player.isSafe();
+}
+
+State State::doMove(MoveType move) const // apply move to a copy of the current state
+{
+    State newState(*this);
+    newState.apply(move, nullptr);
+    return newState;
 }
 
-State State::doMove(MoveType move) const // apply move to current state
+State State::doMove(MoveType move, int diceRoll) const
 {
     State newState(*this);
-    Player &currentPlayerRef = newState.getCurrentPlayer();
+    newState.apply(move, nullptr, diceRoll);
+    return newState;
+}
+
+void State::applyMove(MoveType move)
+{
+    apply(move, nullptr);
+}
+
+void State::applyMove(MoveType move, UndoRecord &undo)
+{
+    apply(move, &undo);
+}
+
+void State::apply(MoveType move, UndoRecord *undo, int diceRoll)
+{
+    Player &currentPlayerRef = getCurrentPlayer();
+
+    if (undo)
+    {
+        undo->move = move;
+        undo->player = currentPlayer;
+        undo->oxygen = oxygen;
+        undo->lastPlayer = lastPlayer;
+        undo->hash = hash;
+        undo->position = currentPlayerRef.position;
+        undo->isReturning = currentPlayerRef.isReturning;
+        undo->tileIndex = -1;
+        undo->inventoryIndex = -1;
+        undo->roundEnded = false;
+    }
 
     if (move == CONTINUE || move == RETURN) // each time a player moves, reduce oxygen if they carry a treasure
     {
-        newState.oxygen -= currentPlayerRef.getTreasures().size();
-        if (newState.oxygen < 0)
-            newState.oxygen = 0;
+        int oldOxygen = oxygen;
+        oxygen -= currentPlayerRef.getTreasures().size();
+        if (oxygen < 0)
+            oxygen = 0;
+
+        if (oxygen != oldOxygen)
+            hash ^= zobrist.value(zobrist.oxygenSalt, oldOxygen) ^ zobrist.value(zobrist.oxygenSalt, oxygen);
+
+        hash ^= zobrist.standing(currentPlayer, currentPlayerRef.position);
+        hash ^= currentPlayerRef.isReturning ? zobrist.returning[currentPlayer] : 0;
+        safe -= currentPlayerRef.isSafe();
     }
 
     switch (move)
     {
     case CONTINUE:
     {
-        int diceResult = newState.throwDice();
-        currentPlayerRef.move(diceResult, newState.board);
+        int diceResult = diceRoll > 0 ? diceRoll : throwDice();
+        currentPlayerRef.move(diceResult, board);
         break;
     }
     case RETURN:
     {
-        int diceResult = newState.throwDice();
+        int diceResult = diceRoll > 0 ? diceRoll : throwDice();
         currentPlayerRef.returnToSubmarine(); // mark the player as returning to submarine
-        currentPlayerRef.move(diceResult, newState.board);
+        currentPlayerRef.move(diceResult, board);
 
         if (currentPlayerRef.getPosition() == 0) // set last player to arrive at submarine
-            newState.lastPlayer = newState.currentPlayer;
+        {
+            hash ^= zobrist.lastPlayer[lastPlayer] ^ zobrist.lastPlayer[currentPlayer];
+            lastPlayer = currentPlayer;
+        }
         break;
     }
     case COLLECT_TREASURE:
     {
         int collectPos = currentPlayerRef.getPosition();
-        if (collectPos > 0 && collectPos <= static_cast<int>(newState.board.getTiles().size()))
+        if (collectPos > 0 && collectPos <= static_cast<int>(board.getTiles().size()))
         {
-            newState.board.flipTile(collectPos);
-            currentPlayerRef.getTreasure(newState.board.getTiles()[collectPos - 1]);
+            Tile &tile = board.getTiles()[collectPos - 1];
+            if (undo)
+            {
+                undo->tileIndex = collectPos - 1;
+                undo->tileFlipped = board.isFlippedAt(collectPos);
+                undo->tileTreasure = tile.treasure;
+            }
+
+            size_t slot = currentPlayerRef.inventory.size();
+            hash ^= zobrist.stack(zobrist.tileChips[collectPos - 1], tile.treasure);
+            hash ^= zobrist.stack(zobrist.inventory[currentPlayer][slot], tile.treasure);
+            hash ^= board.isFlippedAt(collectPos) ? 0 : zobrist.flipped[collectPos - 1];
+
+            board.flipTile(collectPos);
+            currentPlayerRef.getTreasure(tile);
         }
         break;
     }
@@ -451,14 +796,10 @@ State State::doMove(MoveType move) const // apply move to current state
         int minValue = 5; // value means level, since you can't see the values of the treasures
                           // levels are from 0 to 3 (0 having lowest value)
 
-        std::vector<std::vector<int>> &treasures = currentPlayerRef.getTreasures();
+        Inventory &treasures = currentPlayerRef.getTreasures();
         for (size_t i = 0; i < treasures.size(); i++) // drop treasure with lowest level(calculates sum of all levels if stack)
         {
-            int sum = 0;
-            for (size_t j = 0; j < treasures[i].size(); j++)
-            {
-                sum += treasures[i][j];
-            }
+            int sum = treasures[i].levelSum();
 
             if (sum < minValue)
             {
@@ -467,17 +808,38 @@ State State::doMove(MoveType move) const // apply move to current state
             }
         }
 
+        if (undo)
+        {
+            undo->inventoryIndex = minIndex;
+            undo->droppedStack = treasures[minIndex];
+        }
+
         int dropPos = currentPlayerRef.getPosition();
-        if (dropPos > 0 && dropPos <= static_cast<int>(newState.board.getTiles().size()))
+        if (dropPos > 0 && dropPos <= static_cast<int>(board.getTiles().size()))
         {
-            for (auto &treasure : treasures[minIndex])
-                newState.board.getTiles()[dropPos - 1].treasure.push_back(treasure);
+            Tile &tile = board.getTiles()[dropPos - 1];
+            if (undo)
+            {
+                undo->tileIndex = dropPos - 1;
+                undo->tileFlipped = board.isFlippedAt(dropPos);
+                undo->tileTreasure = tile.treasure;
+            }
+
+            hash ^= zobrist.stack(zobrist.tileChips[dropPos - 1], tile.treasure);
+            hash ^= zobrist.stack(zobrist.tileChips[dropPos - 1], treasures[minIndex]);
+            hash ^= board.isFlippedAt(dropPos) ? zobrist.flipped[dropPos - 1] : 0;
+
+            // The stack lands on the blank space the player is standing on
+            tile.treasure = treasures[minIndex];
 
             // Mark tile as having treasure again (unflip it)
-            newState.board.getTiles()[dropPos - 1].flipped = false;
+            board.setFlippedAt(dropPos, false);
         }
 
+        // later stacks shift down one slot
+        hash ^= zobrist.inventoryFrom(currentPlayer, treasures, minIndex);
         treasures.erase(treasures.begin() + minIndex);
+        hash ^= zobrist.inventoryFrom(currentPlayer, treasures, minIndex);
         break;
     }
     case END:
@@ -486,24 +848,89 @@ State State::doMove(MoveType move) const // apply move to current state
         throw std::runtime_error("Invalid action type");
     }
 
-    if (newState.isTerminal())
+    if (move == CONTINUE || move == RETURN)
+    {
+        hash ^= zobrist.standing(currentPlayer, currentPlayerRef.position);
+        hash ^= currentPlayerRef.isReturning ? zobrist.returning[currentPlayer] : 0;
+        safe += currentPlayerRef.isSafe();
+    }
+
+    if (isTerminal())
     {
-        for (auto &player : newState.players)
+        if (undo)
         {
-            if (player.getPosition() != 0) // kill all players that did not reach the submarine
-                player.setIsDead();
+            undo->roundEnded = true;
+            undo->beforeRoundEnd = *this;
         }
 
-        newState.calculatePlayerScores(); // add the captured treasures to the player score
-
-        if (!newState.isLastRound()) // if it's not third round, reset state
-            newState.reset();
+        if (isLastRound())
+        {
+            scoreRound();
+            rehash();
+        }
+        else // if it's not third round, score it and reset state
+            reset();
 
-        return newState;
+        return;
     }
 
     if (currentPlayerRef.getPosition() == 0 || move == COLLECT_TREASURE || move == LEAVE_TREASURE || move == DROP_TREASURE)
-        newState.currentPlayer = (this->currentPlayer + 1) % (players.size()); // it's the next player's turn
+    {
+        int nextPlayer = (currentPlayer + 1) % (players.size()); // it's the next player's turn
+        hash ^= zobrist.currentPlayer[currentPlayer] ^ zobrist.currentPlayer[nextPlayer];
+        currentPlayer = nextPlayer;
+    }
+}
 
-    return newState;
+void State::undoMove(const UndoRecord &undo)
+{
+    if (undo.roundEnded)
+        *this = undo.beforeRoundEnd;
+
+    currentPlayer = undo.player;
+    oxygen = undo.oxygen;
+    lastPlayer = undo.lastPlayer;
+    hash = undo.hash;
+
+    Player &mover = players[currentPlayer];
+    auto &tiles = board.getTiles();
+
+    switch (undo.move)
+    {
+    case CONTINUE:
+    case RETURN:
+    {
+        // move() toggled occupancy on the tile it left and the tile it reached
+        board.toggleOccupied(mover.position);
+        board.toggleOccupied(undo.position);
+
+        safe -= mover.isSafe();
+        mover.position = undo.position;
+        mover.isReturning = undo.isReturning;
+        safe += mover.isSafe();
+        break;
+    }
+    case COLLECT_TREASURE:
+    {
+        if (undo.tileIndex >= 0)
+        {
+            mover.inventory.pop_back();
+            tiles[undo.tileIndex].treasure = undo.tileTreasure;
+            board.setFlippedAt(undo.tileIndex + 1, undo.tileFlipped);
+        }
+        break;
+    }
+    case DROP_TREASURE:
+    {
+        mover.inventory.insert(mover.inventory.begin() + undo.inventoryIndex, undo.droppedStack);
+        if (undo.tileIndex >= 0)
+        {
+            tiles[undo.tileIndex].treasure = undo.tileTreasure;
+            board.setFlippedAt(undo.tileIndex + 1, undo.tileFlipped);
+        }
+        break;
+    }
+    default:
+        break;
+    }
 }
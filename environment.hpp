@@ -1,11 +1,154 @@
 #ifndef ENVIRONMENT_HPP
 #define ENVIRONMENT_HPP
 
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
 #include <vector>
 #include <random>
+#include <type_traits>
+#include "fixed_vector.hpp"
+
+constexpr int MAX_PLAYERS = 6;
+constexpr int BOARD_TILES = 32;    // tiles on the board at the start of a standard game
+constexpr int MAX_STACK_CHIPS = 3; // fallen treasure is stacked in piles of up to 3
+// The path never grows: a fallen stack holds the chips of at least one tile that was
+// taken, blanked and removed, so it can never outnumber them.
+constexpr int MAX_TILES = 64;
+constexpr int MAX_OXYGEN = 64;
+constexpr int MAX_ROUNDS = 8;
+constexpr int MAX_INVENTORY = 12; // holding k stacks has cost at least k(k-1)/2 oxygen, so 64 allows 11
+
+/**
+ * One pile of treasure chips packed into a byte: the chip levels (0-3) take two bits
+ * each in bits 0-5, the chip count bits 6-7. Bits past the last chip are always zero,
+ * so copying or comparing a stack is a single byte operation.
+ */
+class TreasureStack
+{
+private:
+    uint8_t bits = 0;
+
+public:
+    class const_iterator
+    {
+    private:
+        uint8_t bits;
+        int index;
+
+    public:
+        const_iterator(uint8_t bits, int index)
+            : bits(bits), index(index)
+        {
+        }
+
+        uint8_t operator*() const
+        {
+            return (bits >> (2 * index)) & 3;
+        }
+
+        const_iterator &operator++()
+        {
+            index++;
+            return *this;
+        }
+
+        bool operator==(const const_iterator &other) const
+        {
+            return index == other.index;
+        }
 
-using TreasureStack = std::vector<int>;
-using Inventory = std::vector<TreasureStack>;
+        bool operator!=(const const_iterator &other) const
+        {
+            return index != other.index;
+        }
+    };
+
+    TreasureStack() = default;
+
+    TreasureStack(std::initializer_list<uint8_t> levels)
+    {
+        for (uint8_t level : levels)
+            push_back(level);
+    }
+
+    // the packed byte, as the batch simulator stores it
+    uint8_t code() const
+    {
+        return this->bits;
+    }
+
+    static TreasureStack fromCode(uint8_t code)
+    {
+        TreasureStack stack;
+        stack.bits = code;
+        return stack;
+    }
+
+    size_t size() const
+    {
+        return bits >> 6;
+    }
+
+    bool empty() const
+    {
+        return bits == 0;
+    }
+
+    bool full() const
+    {
+        return size() == MAX_STACK_CHIPS;
+    }
+
+    uint8_t operator[](size_t index) const
+    {
+        return (bits >> (2 * index)) & 3;
+    }
+
+    int levelSum() const
+    {
+        return (bits & 3) + ((bits >> 2) & 3) + ((bits >> 4) & 3);
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator(bits, 0);
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(bits, static_cast<int>(size()));
+    }
+
+    void push_back(uint8_t level)
+    {
+        if (full())
+            throw std::length_error("Treasure stack holds at most 3 chips");
+        if (level > 3)
+            throw std::runtime_error("Invalid chip level");
+
+        size_t count = size();
+        bits = static_cast<uint8_t>(((count + 1) << 6) | (bits & 0x3F) | (level << (2 * count)));
+    }
+
+    void clear()
+    {
+        bits = 0;
+    }
+
+    bool operator==(const TreasureStack &other) const
+    {
+        return bits == other.bits;
+    }
+
+    bool operator!=(const TreasureStack &other) const
+    {
+        return bits != other.bits;
+    }
+};
+
+using Inventory = FixedVector<TreasureStack, MAX_INVENTORY>;
 
 enum MoveType
 {
@@ -17,85 +160,400 @@ enum MoveType
     END,
 };
 
-class Tile
+using MoveMask = uint8_t; // bit m is set when MoveType m is available
+
+constexpr int MAX_MOVES = 3; // a decision never offers more than three options
+
+/**
+ * Legal moves of a decision, stored inline (no heap allocation).
+ */
+class MoveList : public FixedVector<MoveType, MAX_MOVES>
 {
 public:
-    int level;
-    bool flipped = false;
-    bool occupied = false;
-    int droppedTreasureCount = 0;
-    TreasureStack treasure;
+    using FixedVector::FixedVector;
 
-    void flip()
+    bool contains(MoveType move) const
     {
-        this->flipped = true;
+        for (MoveType m : *this)
+            if (m == move)
+                return true;
+        return false;
     }
 
-    bool isFlipped() const
+    MoveMask mask() const
     {
-        return flipped;
+        MoveMask result = 0;
+        for (MoveType m : *this)
+            result |= MoveMask(1) << m;
+        return result;
     }
+};
+
+inline int countMoves(MoveMask mask)
+{
+    return __builtin_popcount(mask);
+}
+
+// the n-th (0-based) move in the mask, in MoveType order
+inline MoveType nthMove(MoveMask mask, int n)
+{
+    for (int i = 0; i < n; i++)
+        mask &= mask - 1;
+    return static_cast<MoveType>(__builtin_ctz(mask));
+}
+
+/**
+ * xoshiro256** generator. Streams handed out by split() are 2^128 draws apart, so every
+ * worker or game can own an independent, explicitly seeded sequence. It also satisfies
+ * UniformRandomBitGenerator and can drive the standard distributions.
+ */
+class RNG
+{
+private:
+    uint64_t s[4];
 
-    bool isOccupied() const
+    static uint64_t rotl(uint64_t x, int k)
     {
-        return occupied;
+        return (x << k) | (x >> (64 - k));
     }
 
-    void changeOccupationStatus();
+public:
+    using result_type = uint64_t;
 
-    static std::vector<int> tileValues0; // possible values for tiles with level 0
-    static std::vector<int> tileValues1; // possible values for tiles with level 1
-    static std::vector<int> tileValues2; // possible values for tiles with level 2
-    static std::vector<int> tileValues3; // possible values for tiles with level 3
-    static void resetValuePools();
+    explicit RNG(uint64_t seed = 0)
+    {
+        reseed(seed);
+    }
 
-    // For MCTS: save and restore value pools to avoid exhaustion during simulations
-    struct ValuePoolSnapshot
+    static uint64_t splitMix64(uint64_t x)
     {
-        std::vector<int> v0, v1, v2, v3;
-    };
-    static ValuePoolSnapshot saveValuePools();
-    static void restoreValuePools(const ValuePoolSnapshot &snapshot);
+        x += 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+    void reseed(uint64_t seed)
+    {
+        for (int i = 0; i < 4; i++)
+            s[i] = splitMix64(seed + i * 0x9E3779B97F4A7C15ULL);
+    }
+
+    uint64_t next()
+    {
+        uint64_t result = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // uniform in [0, n) without modulo bias (Lemire's multiply-and-reject)
+    uint32_t below(uint32_t n)
+    {
+        uint64_t m = (next() >> 32) * n;
+        if (static_cast<uint32_t>(m) < n)
+        {
+            uint32_t threshold = -n % n;
+            while (static_cast<uint32_t>(m) < threshold)
+                m = (next() >> 32) * n;
+        }
+        return static_cast<uint32_t>(m >> 32);
+    }
+
+    int d3()
+    {
+        return 1 + static_cast<int>(below(3));
+    }
+
+    void jump();  // advance by 2^128 draws
+    RNG split();  // returns the current stream and jumps this generator past it
+
+    static RNG &local(); // per-thread generator seeded from std::random_device
+
+    static constexpr result_type min()
+    {
+        return 0;
+    }
+
+    static constexpr result_type max()
+    {
+        return ~result_type(0);
+    }
+
+    result_type operator()()
+    {
+        return next();
+    }
+};
+
+constexpr int CHIP_LEVELS = 4;          // treasure chips come in levels 0-3
+constexpr int VALUES_PER_LEVEL = 4;     // level l chips are worth 4l .. 4l+3
+constexpr int COPIES_PER_VALUE = 2;     // two chips of every value in the standard game
+constexpr int MAX_COPIES_PER_VALUE = MAX_TILES / (CHIP_LEVELS * VALUES_PER_LEVEL);
+
+/**
+ * The parameters of a game. The defaults are the published rules; the rest are for
+ * experiments on how search cost scales with game length. The board is dealt evenly
+ * over the four levels with every value of a level appearing equally often, so its
+ * length must be a multiple of 16. validate() throws std::runtime_error for a
+ * configuration outside the fixed capacities above.
+ */
+struct RulesConfig
+{
+    int boardTiles = BOARD_TILES; // tiles at the start of the game
+    int oxygen = 25;              // air in the shared tank at the start of every round
+    int diceCount = 2;            // a move throws diceCount dice numbered 1..diceSides
+    int diceSides = 3;
+    int rounds = 3;
+
+    void validate() const;
+
+    int copiesPerValue() const
+    {
+        return boardTiles / (CHIP_LEVELS * VALUES_PER_LEVEL);
+    }
+
+    bool isStandardDice() const
+    {
+        return diceCount == 2 && diceSides == 3;
+    }
+
+    int minRoll() const
+    {
+        return diceCount;
+    }
+
+    int maxRoll() const
+    {
+        return diceCount * diceSides;
+    }
+
+    double rollProbability(int sum) const; // chance that one throw adds up to sum
+
+    int roll(RNG &rng) const
+    {
+        if (isStandardDice())
+            return rng.d3() + rng.d3();
+
+        int sum = 0;
+        for (int i = 0; i < diceCount; i++)
+            sum += 1 + static_cast<int>(rng.below(diceSides));
+        return sum;
+    }
+
+    bool operator==(const RulesConfig &other) const
+    {
+        return boardTiles == other.boardTiles && oxygen == other.oxygen && diceCount == other.diceCount &&
+               diceSides == other.diceSides && rounds == other.rounds;
+    }
 
-    // Flag to use deterministic values during MCTS (avoids pool exhaustion)
-    static bool useDeterministicValues;
+    bool operator!=(const RulesConfig &other) const
+    {
+        return !(*this == other);
+    }
+};
 
-    static int calculateTreasureValue(TreasureStack stack); // convert tile level to an actual value
+/**
+ * How chips are valued when a round is scored. The real game draws the hidden
+ * values; searches can use a fixed or expected value instead, which keeps
+ * simulated scoring from consuming the pools.
+ */
+enum class ValuationPolicy : uint8_t
+{
+    EXACT_DRAW,     // draw the value from the remaining pool
+    MIDPOINT,       // 2, 6, 10, 14 for levels 0-3
+    EXPECTED_VALUE, // mean of the values still in the pool. The pools refill every round and this
+                    // policy never draws, so the mean is per round: with full pools, 4l + 1.5 for level l
 };
 
+/**
+ * Hidden values of the treasure chips that have not been scored yet this round.
+ * State::reset refills them for every new round, so depletion never carries over.
+ * Kept per game so independent games never share them.
+ */
+class ValuePools
+{
+    friend class StateCodec;
+
+private:
+    uint8_t counts[CHIP_LEVELS][VALUES_PER_LEVEL]; // copies left of value 4 * level + v
+    uint8_t totals[CHIP_LEVELS];                   // chips left per level, kept in step with counts
+    uint8_t sums[CHIP_LEVELS];                     // and the sum of their values
+    static_assert(VALUES_PER_LEVEL * MAX_COPIES_PER_VALUE * (VALUES_PER_LEVEL * CHIP_LEVELS - 1) < 256,
+                  "Per-level value sums must fit in a byte");
+
+    void recount(); // rebuilds totals and sums after counts was written directly
+
+public:
+    explicit ValuePools(int copies = COPIES_PER_VALUE)
+    {
+        reset(copies);
+    }
+
+    void reset(int copies = COPIES_PER_VALUE);
+    int draw(int level, RNG &rng); // remove a random value of that level from the pool
+
+    // mean value of the chips of that level still in the pool, the exact expectation of the next draw
+    double expectedValue(int level) const
+    {
+        if (totals[level] == 0)
+            throw std::runtime_error("Cannot value a chip from an empty value pool");
+
+        return static_cast<double>(sums[level]) / totals[level];
+    }
+
+    int remaining(int level, int value) const
+    {
+        return counts[level][value - VALUES_PER_LEVEL * level];
+    }
+
+    bool operator==(const ValuePools &other) const;
+    bool operator!=(const ValuePools &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+class Tile
+{
+public:
+    int8_t level = 0;       // 0-3 for regular tiles, 4 for fallen treasure
+    TreasureStack treasure; // chips lying on the tile; regular tiles start with one chip of their level
+
+    bool operator==(const Tile &other) const
+    {
+        return level == other.level && treasure == other.treasure;
+    }
+
+    // convert chip levels to points; only EXACT_DRAW takes values out of the pools
+    static double calculateTreasureValue(const TreasureStack &stack, ValuePools &pools, ValuationPolicy policy, RNG &rng);
+};
+
+using TileList = FixedVector<Tile, MAX_TILES>;
+
+static_assert(MAX_TILES <= 64, "Board masks hold one bit per tile");
+
+/**
+ * Movement lookup tables behind Board::destination. A standard roll moves at most MAX_DISTANCE
+ * free tiles and at most MAX_PLAYERS - 1 other divers can be in the way, so the landing tile
+ * always lies within WINDOW tiles of the start unless the path runs out first. Longer rolls
+ * under custom dice take the bit-select path.
+ * forward[d - 1][w] is the 1-based offset of the d-th free tile counting up from bit 0 of the
+ * window w, backward[d - 1][w] counts down from the top bit; 0 means the window is too short.
+ */
+struct MoveTables
+{
+    static constexpr int MAX_DISTANCE = 6;
+    static constexpr int WINDOW = MAX_DISTANCE + MAX_PLAYERS - 1;
+    static constexpr uint32_t WINDOW_MASK = (1u << WINDOW) - 1;
+
+    uint8_t forward[MAX_DISTANCE][1 << WINDOW];
+    uint8_t backward[MAX_DISTANCE][1 << WINDOW];
+};
+
+extern const MoveTables moveTables;
+
+/**
+ * The ocean path. Flipped (blank) and occupied tiles are kept as bitmasks,
+ * bit i standing for the tile at position i + 1, so movement can skip
+ * occupied tiles with popcount/select instead of walking the path.
+ */
 class Board
 {
+    friend class StateCodec;
+
 private:
-    std::vector<Tile> tiles;
+    TileList tiles;
+    uint64_t flippedMask = 0;
+    uint64_t occupiedMask = 0;
 
 public:
-    Board()
+    explicit Board(int size = BOARD_TILES)
     {
-        tiles = {
-            {0, false, false, 0, {}}, {0, false, false, 0, {}}, {0, false, false, 0, {}}, {0, false, false, 0, {}}, {0, false, false, 0, {}}, {0, false, false, 0, {}}, {0, false, false, 0, {}}, {0, false, false, 0, {}}, {1, false, false, 0, {}}, {1, false, false, 0, {}}, {1, false, false, 0, {}}, {1, false, false, 0, {}}, {1, false, false, 0, {}}, {1, false, false, 0, {}}, {1, false, false, 0, {}}, {1, false, false, 0, {}}, {2, false, false, 0, {}}, {2, false, false, 0, {}}, {2, false, false, 0, {}}, {2, false, false, 0, {}}, {2, false, false, 0, {}}, {2, false, false, 0, {}}, {2, false, false, 0, {}}, {2, false, false, 0, {}}, {3, false, false, 0, {}}, {3, false, false, 0, {}}, {3, false, false, 0, {}}, {3, false, false, 0, {}}, {3, false, false, 0, {}}, {3, false, false, 0, {}}, {3, false, false, 0, {}}, {3, false, false, 0, {}}};
+        tiles.resize(size);
+        for (int i = 0; i < size; i++) // the same number of tiles per level, shallow to deep
+        {
+            int level = i * CHIP_LEVELS / size;
+            tiles[i].level = static_cast<int8_t>(level);
+            tiles[i].treasure.push_back(static_cast<uint8_t>(level));
+        }
     }
 
-    std::vector<Tile> &getTiles()
+    TileList &getTiles()
     {
         return this->tiles;
     }
 
-    const std::vector<Tile> &getTiles() const
+    const TileList &getTiles() const
     {
         return this->tiles;
     }
 
+    uint64_t getFlippedMask() const
+    {
+        return this->flippedMask;
+    }
+
+    uint64_t getOccupiedMask() const
+    {
+        return this->occupiedMask;
+    }
+
+    // Unchecked mask lookups for positions already known to be on the board (1..size)
+    bool isFlippedAt(int position) const
+    {
+        return (flippedMask >> (position - 1)) & 1;
+    }
+
+    void setFlippedAt(int position, bool flipped)
+    {
+        uint64_t bit = uint64_t(1) << (position - 1);
+        flippedMask = flipped ? (flippedMask | bit) : (flippedMask & ~bit);
+    }
+
+    void toggleOccupied(int position) // a diver leaves or enters a tile; the submarine is never occupied
+    {
+        if (position > 0)
+            occupiedMask ^= uint64_t(1) << (position - 1);
+    }
+
     void updateBoard();
     void flipTile(int index);
     bool isTileFlipped(int index) const;
-    bool isTileOccupied(int index);
+    bool isTileOccupied(int index) const;
+    int destination(int position, int distance, bool &isReturning) const
+    {
+        return destination(occupiedMask, static_cast<int>(tiles.size()), position, distance, isReturning);
+    }
+
+    int selectDestination(int position, int distance, bool &isReturning) const
+    {
+        return selectDestination(occupiedMask, static_cast<int>(tiles.size()), position, distance, isReturning);
+    }
+
+    // the same kernels on a bare occupancy mask, for callers that keep their own board layout
+    static int destination(uint64_t occupiedMask, int size, int position, int distance, bool &isReturning); // table lookup
+    static int selectDestination(uint64_t occupiedMask, int size, int position, int distance, bool &isReturning);
+
+    bool operator==(const Board &other) const
+    {
+        return tiles == other.tiles && flippedMask == other.flippedMask && occupiedMask == other.occupiedMask;
+    }
 };
 
 class Player
 {
+    friend class State; // restores positions and flags when a move is undone
+    friend class StateCodec;
+
 private:
     Inventory inventory;
-    int points = 0;
+    double points = 0; // fractional only when scored with ValuationPolicy::EXPECTED_VALUE
     int position = 0; // 0 means the submarine for all intents and purposes
     bool isDead = false;
     bool isReturning = false;
@@ -121,17 +579,32 @@ public:
         return this->isReturning;
     }
 
+    bool isSafe() const // out of the round: drowned, or turned around and back in the submarine
+    {
+        return this->isDead || (this->position == 0 && this->isReturning);
+    }
+
     Inventory &getTreasures()
     {
         return this->inventory;
     }
 
+    const Inventory &getTreasures() const
+    {
+        return this->inventory;
+    }
+
     int getPoints() const
+    {
+        return static_cast<int>(std::lround(this->points));
+    }
+
+    double getScore() const
     {
         return this->points;
     }
 
-    void addPoints(int points)
+    void addPoints(double points)
     {
         this->points += points;
     }
@@ -144,61 +617,55 @@ public:
     void reset();
     void move(int distance, Board &board);
     void getTreasure(Tile &tile);
-    int calculateValue(TreasureStack stack);
-};
-
-class RNG
-{
-private:
-    thread_local static std::random_device rd;
-
-public:
-    thread_local static std::mt19937 gen;
-    static std::uniform_int_distribution<int> dist1;
-    static std::uniform_int_distribution<int> dist2;
+    int calculateValue(const TreasureStack &stack);
 
-    RNG() = delete;
+    bool operator==(const Player &other) const
+    {
+        return inventory == other.inventory && points == other.points && position == other.position &&
+               isDead == other.isDead && isReturning == other.isReturning;
+    }
 };
 
+struct UndoRecord;
+
 class State
 {
+    friend class StateCodec; // binary encoding, see state_codec.hpp
+
 private:
     int currentPlayer = 0;
     int currentRound = 0;
-    int oxygen = 25;
-    std::vector<Player> players;
+    int oxygen;
+    FixedVector<Player, MAX_PLAYERS> players;
     Board board;
+    ValuePools valuePools;
+    RulesConfig rules;
+    ValuationPolicy valuation = ValuationPolicy::EXACT_DRAW;
+    RNG *rng = nullptr; // dice and value draws; the thread's RNG::local() when unset
     int lastPlayer = 0; // last player to arrive at submarine
+    uint64_t hash = 0;  // Zobrist key of everything above, kept up to date by applyMove
+    int safe = 0;       // players dead or back in the submarine, kept up to date by applyMove
     int throwDice();
+    void scoreRound();
+    void apply(MoveType move, UndoRecord *undo, int diceRoll = 0); // 0 throws the dice
 
-public:
-    State(int nPlayers)
+    static const RulesConfig &checked(const RulesConfig &rules) // validates before the board is laid out
     {
-        players.resize(nPlayers);
+        rules.validate();
+        return rules;
     }
 
-    State(const State &other)
-        : currentPlayer(other.currentPlayer),
-          currentRound(other.currentRound),
-          oxygen(other.oxygen),
-          players(other.players),
-          board(other.board),
-          lastPlayer(other.lastPlayer)
+public:
+    explicit State(int nPlayers, const RulesConfig &rules = RulesConfig())
+        : oxygen(checked(rules).oxygen), board(rules.boardTiles), valuePools(rules.copiesPerValue()), rules(rules)
     {
+        players.resize(nPlayers);
+        rehash();
     }
 
-    State &operator=(const State &other)
+    const RulesConfig &getRules() const
     {
-        if (this != &other)
-        {
-            currentPlayer = other.currentPlayer;
-            currentRound = other.currentRound;
-            oxygen = other.oxygen;
-            players = other.players;
-            board = other.board;
-            lastPlayer = other.lastPlayer;
-        }
-        return *this;
+        return this->rules;
     }
 
     int getOxygen() const
@@ -216,6 +683,31 @@ public:
         return this->board;
     }
 
+    const ValuePools &getValuePools() const
+    {
+        return this->valuePools;
+    }
+
+    ValuationPolicy getValuationPolicy() const
+    {
+        return this->valuation;
+    }
+
+    void setValuationPolicy(ValuationPolicy policy)
+    {
+        this->valuation = policy;
+    }
+
+    RNG &getRng() const
+    {
+        return this->rng ? *this->rng : RNG::local();
+    }
+
+    void setRng(RNG *stream) // not owned; copies of the state share the stream
+    {
+        this->rng = stream;
+    }
+
     int getCurrentPlayerIndex() const
     {
         return this->currentPlayer;
@@ -226,12 +718,17 @@ public:
         return this->currentRound;
     }
 
-    std::vector<Player> &getPlayers()
+    int getLastPlayerIndex() const
+    {
+        return this->lastPlayer;
+    }
+
+    FixedVector<Player, MAX_PLAYERS> &getPlayers()
     {
         return this->players;
     }
 
-    const std::vector<Player> &getPlayers() const
+    const FixedVector<Player, MAX_PLAYERS> &getPlayers() const
     {
         return this->players;
     }
@@ -242,8 +739,62 @@ public:
     void calculatePlayerScores();
     bool isTerminal() const;
     Player &getCurrentPlayer();
-    std::vector<MoveType> getPossibleMoves(bool movedThisTurn) const;
+    MoveList getPossibleMoves(bool movedThisTurn) const;
     State doMove(MoveType move) const;
+
+    // In-place variants of doMove: applyMove(move) mutates this state,
+    // applyMove(move, undo) also records what changed so undoMove can revert it
+    void applyMove(MoveType move);
+    void applyMove(MoveType move, UndoRecord &undo);
+    void undoMove(const UndoRecord &undo);
+
+    // CONTINUE or RETURN with the dice already thrown, for search trees that branch on the roll
+    State doMove(MoveType move, int diceRoll) const;
+
+    // 64-bit Zobrist key of the position; movedThisTurn tells the move phase
+    // (continue/return vs. collect/leave/drop), which the state itself does not store
+    uint64_t getHash(bool movedThisTurn) const;
+    uint64_t computeHash(bool movedThisTurn) const; // full recomputation, for verification
+    void rehash(); // resynchronise the key and the safe count after editing players or tiles directly
+
+    bool operator==(const State &other) const
+    {
+        return currentPlayer == other.currentPlayer && currentRound == other.currentRound &&
+               oxygen == other.oxygen && players == other.players && board == other.board &&
+               valuePools == other.valuePools && valuation == other.valuation && lastPlayer == other.lastPlayer &&
+               rules == other.rules;
+    }
+
+    bool operator!=(const State &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+// States are copied on every ply, so they must stay flat (no heap members)
+static_assert(std::is_trivially_copyable<State>::value, "State must be memcpy-copyable");
+
+/**
+ * Everything applyMove changed, so undoMove can restore the previous state
+ * without keeping a full copy around. Only a move that ends the round
+ * (scoring, board compaction, fallen stacks, player reset) keeps a snapshot.
+ */
+struct UndoRecord
+{
+    MoveType move = END;
+    int player = 0;           // player who made the move
+    int oxygen = 0;           // oxygen before the move
+    int lastPlayer = 0;
+    uint64_t hash = 0;        // Zobrist key before the move
+    int position = 0;         // mover's position before the move
+    bool isReturning = false; // mover's direction before the move
+    int tileIndex = -1;       // tile flipped by a pickup or unflipped by a drop
+    bool tileFlipped = false;
+    TreasureStack tileTreasure; // chips on that tile before the move
+    int inventoryIndex = -1;  // slot of the dropped stack
+    TreasureStack droppedStack;
+    bool roundEnded = false;
+    State beforeRoundEnd = State(0); // state after the move but before the round was scored
 };
 
 #endif // ENVIRONMENT_HPP
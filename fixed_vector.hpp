@@ -0,0 +1,177 @@
+#ifndef FIXED_VECTOR_HPP
+#define FIXED_VECTOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <type_traits>
+
+/**
+ * Vector-like container with inline storage for at most N elements.
+ * It never allocates, so any state built from it stays memcpy-copyable.
+ */
+template <typename T, size_t N>
+class FixedVector
+{
+    static_assert(std::is_trivially_copyable<T>::value, "FixedVector elements must be trivially copyable");
+
+public:
+    using size_type = std::conditional_t<(N < 256), uint8_t, uint16_t>;
+    using value_type = T;
+    using iterator = T *;
+    using const_iterator = const T *;
+
+private:
+    T items[N]{};
+    size_type count = 0;
+
+public:
+    FixedVector() = default;
+
+    FixedVector(std::initializer_list<T> init)
+    {
+        for (const T &item : init)
+            push_back(item);
+    }
+
+    static constexpr size_t capacity()
+    {
+        return N;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    bool full() const
+    {
+        return count == N;
+    }
+
+    T &operator[](size_t index)
+    {
+        return items[index];
+    }
+
+    const T &operator[](size_t index) const
+    {
+        return items[index];
+    }
+
+    T &front()
+    {
+        return items[0];
+    }
+
+    const T &front() const
+    {
+        return items[0];
+    }
+
+    T &back()
+    {
+        return items[count - 1];
+    }
+
+    const T &back() const
+    {
+        return items[count - 1];
+    }
+
+    iterator begin()
+    {
+        return items;
+    }
+
+    iterator end()
+    {
+        return items + count;
+    }
+
+    const_iterator begin() const
+    {
+        return items;
+    }
+
+    const_iterator end() const
+    {
+        return items + count;
+    }
+
+    void push_back(const T &item)
+    {
+        if (count >= N)
+            throw std::length_error("FixedVector capacity exceeded");
+
+        items[count++] = item;
+    }
+
+    void pop_back()
+    {
+        count--;
+    }
+
+    void clear()
+    {
+        count = 0;
+    }
+
+    void resize(size_t newSize)
+    {
+        if (newSize > N)
+            throw std::length_error("FixedVector capacity exceeded");
+
+        for (size_t i = count; i < newSize; i++)
+            items[i] = T{};
+
+        count = static_cast<size_type>(newSize);
+    }
+
+    iterator insert(iterator position, const T &item)
+    {
+        if (count >= N)
+            throw std::length_error("FixedVector capacity exceeded");
+
+        for (iterator it = end(); it > position; --it)
+            *it = *(it - 1);
+
+        *position = item;
+        count++;
+        return position;
+    }
+
+    iterator erase(iterator position)
+    {
+        for (iterator it = position; it + 1 < end(); ++it)
+            *it = *(it + 1);
+
+        count--;
+        return position;
+    }
+
+    bool operator==(const FixedVector &other) const
+    {
+        if (count != other.count)
+            return false;
+
+        for (size_t i = 0; i < count; i++)
+            if (!(items[i] == other.items[i]))
+                return false;
+
+        return true;
+    }
+
+    bool operator!=(const FixedVector &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+#endif // FIXED_VECTOR_HPP
@@ -5,10 +5,11 @@ MoveType HeuristicBot::findBestMove(const State &state, int playerIndex, bool mo
 {
     const Player &player = state.getPlayers()[playerIndex];
     int oxygen = state.getOxygen();
+    int fullTank = state.getRules().oxygen;
     bool isReturning = player.getIsReturning();
-    int treasureCount = static_cast<int>(const_cast<Player &>(player).getTreasures().size());
+    int treasureCount = static_cast<int>(player.getTreasures().size());
 
-    std::vector<MoveType> possibleMoves = state.getPossibleMoves(movedThisTurn);
+    MoveList possibleMoves = state.getPossibleMoves(movedThisTurn);
 
     if (possibleMoves.empty())
     {
@@ -18,7 +19,7 @@ MoveType HeuristicBot::findBestMove(const State &state, int playerIndex, bool mo
 
     auto hasMove = [&possibleMoves](MoveType move)
     {
-        return std::find(possibleMoves.begin(), possibleMoves.end(), move) != possibleMoves.end();
+        return possibleMoves.contains(move);
     };
 
     if (movedThisTurn)
@@ -31,14 +32,14 @@ MoveType HeuristicBot::findBestMove(const State &state, int playerIndex, bool mo
         {
             if (hasMove(COLLECT_TREASURE))
             {
-                // Rule 2: Exception - if O2 is under 23, or you're farther than half the distance
+                // Rule 2: Exception - if O2 is 2 under a full tank, or you're farther than half the distance
                 // and someone else took a treasure last round, take the next treasure
-                if (oxygen < 23)
+                if (oxygen < fullTank - 2)
                 {
                     return COLLECT_TREASURE;
                 }
 
-                if (position > boardSize / 2 && oxygen < 25)
+                if (position > boardSize / 2 && oxygen < fullTank)
                 {
                     return COLLECT_TREASURE;
                 }
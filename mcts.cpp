@@ -5,6 +5,18 @@
 
 MoveType MCTS::findBestMove(const State &state, [[maybe_unused]] int playerIndex, bool movedThisTurn)
 {
+    return search(state, movedThisTurn, SearchDeadline());
+}
+
+MoveType MCTS::findBestMove(const State &state, [[maybe_unused]] int playerIndex, bool movedThisTurn,
+                            std::chrono::milliseconds budget)
+{
+    return search(state, movedThisTurn, SearchDeadline(budget));
+}
+
+MoveType MCTS::search(const State &state, bool movedThisTurn, const SearchDeadline &deadline)
+{
+    lastIterations = 0;
     auto moves = state.getPossibleMoves(movedThisTurn);
     if (moves.empty())
         return LEAVE_TREASURE;
@@ -13,52 +25,185 @@ MoveType MCTS::findBestMove(const State &state, [[maybe_unused]] int playerIndex
         std::cerr << "[MCTS] Only 1 move available, skipping search\n";
         return moves[0];
     }
-    std::cerr << "[MCTS] Running " << iterations << " iterations...\n";
 
-    Tile::useDeterministicValues = true;
+    State rootState = state;
+    rootState.setValuationPolicy(valuation); // simulated round ends never touch the real value pools
+    rootState.setRng(&rng);
 
-    auto root = std::make_unique<MCTSNode>(state, nullptr, LEAVE_TREASURE, movedThisTurn, numPlayers);
+    nodesCreated = 0;
+    transpositionHits = 0;
+    reroot(rootState, movedThisTurn);
+    if (deadline.isTimed())
+        std::cerr << "[MCTS] Running up to " << std::max(0, iterations - reusedVisits) << " iterations ("
+                  << reusedVisits << " reused) before the deadline...\n";
+    else
+        std::cerr << "[MCTS] Running " << std::max(0, iterations - reusedVisits) << " iterations ("
+                  << reusedVisits << " reused)...\n";
 
-    for (int i = 0; i < iterations; i++)
+    int i = reusedVisits;
+    while (i < iterations)
     {
-        MCTSNode *selected = select(root.get());
-
-        MCTSNode *expanded = selected;
-        if (!selected->isTerminal() && !selected->unexpandedMoves.empty())
-            expanded = expand(selected);
-
-        std::vector<double> rewards = simulate(expanded);
+        int batchEnd = deadline.isTimed() ? std::min(iterations, i + SearchDeadline::CHECK_INTERVAL) : iterations;
+        for (; i < batchEnd; i++)
+            iterate();
 
-        backpropagate(expanded, rewards);
+        if (deadline.isTimed())
+        {
+            long remaining = std::min<long>(iterations - i, deadline.remainingIterations(i - reusedVisits));
+            if (remaining == 0 || isDecided(remaining))
+                break;
+        }
     }
+    lastIterations = std::max(0, i - reusedVisits);
+    if (deadline.isTimed())
+        std::cerr << "[MCTS] Ran " << lastIterations << " iterations\n";
 
-    Tile::useDeterministicValues = false;
-
-    MCTSNode *bestChild = nullptr;
+    // a shared child may have been created by another parent's move, so the edge holds ours
+    int bestChild = -1;
     int bestVisits = -1;
 
-    for (auto &child : root->children)
+    for (size_t i = 0; i < root->children.size(); i++)
     {
-        if (child->visits > bestVisits)
+        if (root->children[i]->visits > bestVisits)
         {
-            bestVisits = child->visits;
-            bestChild = child.get();
+            bestVisits = root->children[i]->visits;
+            bestChild = static_cast<int>(i);
         }
     }
 
-    if (bestChild == nullptr)
+    if (bestChild < 0)
     {
         auto moves = state.getPossibleMoves(movedThisTurn);
         return moves.empty() ? LEAVE_TREASURE : moves[0];
     }
 
-    return bestChild->moveFromParent;
+    return root->childMoves[bestChild];
+}
+
+void MCTS::iterate()
+{
+    MCTSNode *selected = select(root.get());
+
+    MCTSNode *expanded = selected;
+    if (!selected->isTerminal() && !selected->isFullyExpanded())
+        expanded = expand(selected);
+
+    std::vector<double> rewards = simulate(expanded);
+
+    backpropagate(rewards);
+}
+
+// whether the most visited root move stays ahead through `remaining` more iterations
+bool MCTS::isDecided(long remaining) const
+{
+    int best = 0;
+    int second = 0;
+    for (const auto &child : root->children)
+    {
+        if (child->visits > best)
+        {
+            second = best;
+            best = child->visits;
+        }
+        else if (child->visits > second)
+        {
+            second = child->visits;
+        }
+    }
+    return SearchDeadline::isDecided(best, second, remaining);
+}
+
+/**
+ * Makes the node for `state` the root. When the previous tree already holds the position
+ * (our own move, and the dice and opponents' moves since, were all expanded) that subtree
+ * is kept with its statistics and everything else is freed; otherwise the tree starts over.
+ */
+void MCTS::reroot(const State &state, bool movedThisTurn)
+{
+    walk++;
+    MCTSNode *found = root ? findNode(root.get(), state, state.getHash(movedThisTurn), movedThisTurn) : nullptr;
+
+    if (found == nullptr)
+    {
+        root = std::make_shared<MCTSNode>(state, LEAVE_TREASURE, movedThisTurn, numPlayers);
+        nodesCreated++;
+    }
+    else if (found != root.get())
+    {
+        root = found->shared_from_this(); // releases the old root and the branches not taken
+    }
+
+    // the table may point at freed nodes now; index what is left
+    if (transpositions.enabled())
+    {
+        transpositions.clear();
+        walk++;
+        indexTree(root.get());
+    }
+
+    reusedVisits = root->visits;
+}
+
+// Depth-first over the DAG, each node once per walk
+MCTSNode *MCTS::findNode(MCTSNode *node, const State &state, uint64_t hash, bool movedThisTurn)
+{
+    if (node->mark == walk)
+        return nullptr;
+    node->mark = walk;
+
+    const State &candidate = node->state;
+    if (node->nodeType == NodeType::DECISION && candidate.getHash(node->movedThisTurn) == hash &&
+        node->movedThisTurn == movedThisTurn && candidate == state)
+        return node;
+
+    // rounds only advance and oxygen only falls within one, so nothing below can match
+    if (candidate.getCurrentRound() > state.getCurrentRound() ||
+        (candidate.getCurrentRound() == state.getCurrentRound() && candidate.getOxygen() < state.getOxygen()))
+        return nullptr;
+
+    for (auto &child : node->children)
+        if (child)
+            if (MCTSNode *match = findNode(child.get(), state, hash, movedThisTurn))
+                return match;
+
+    return nullptr;
+}
+
+void MCTS::indexTree(MCTSNode *node)
+{
+    if (node->mark == walk)
+        return;
+    node->mark = walk;
+
+    if (node->nodeType == NodeType::DECISION)
+        transpositions.insert(node->state.getHash(node->movedThisTurn), node);
+
+    for (auto &child : node->children)
+        if (child)
+            indexTree(child.get());
 }
 
 MCTSNode *MCTS::select(MCTSNode *node)
 {
+    path.clear();
+    path.push_back(node);
+
     while (!node->isTerminal())
     {
+        if (node->nodeType == NodeType::CHANCE)
+        {
+            int roll = node->state.getRules().roll(rng);
+            MCTSNode *outcome = node->childForRoll(roll);
+            if (outcome == nullptr)
+            {
+                node->pendingRoll = roll;
+                return node;
+            }
+            node = outcome;
+            path.push_back(node);
+            continue;
+        }
+
         if (!node->isFullyExpanded())
             return node;
 
@@ -66,6 +211,7 @@ MCTSNode *MCTS::select(MCTSNode *node)
             return node;
 
         node = selectBestChild(node);
+        path.push_back(node);
     }
 
     return node;
@@ -80,7 +226,7 @@ MCTSNode *MCTS::selectBestChild(MCTSNode *node)
 
     for (auto &child : node->children)
     {
-        double score = child->getUCB1(currentPlayer, explorationConstant);
+        double score = child->getUCB1(currentPlayer, node->visits, explorationConstant);
         if (score > bestScore)
         {
             bestScore = score;
@@ -93,118 +239,111 @@ MCTSNode *MCTS::selectBestChild(MCTSNode *node)
 
 MCTSNode *MCTS::expand(MCTSNode *node)
 {
-    if (node->unexpandedMoves.empty())
+    if (node->isFullyExpanded())
         return node;
 
-    std::uniform_int_distribution<size_t> dist(0, node->unexpandedMoves.size() - 1);
-    size_t moveIndex = dist(rng);
-    MoveType move = node->unexpandedMoves[moveIndex];
+    if (node->nodeType == NodeType::CHANCE)
+        return expandRoll(node);
 
-    node->unexpandedMoves.erase(node->unexpandedMoves.begin() + moveIndex);
+    MoveType move = nthMove(node->unexpandedMoves, rng.below(countMoves(node->unexpandedMoves)));
 
-    State newState = node->state.doMove(move);
-
-    bool newMovedThisTurn;
+    node->unexpandedMoves &= ~(MoveMask(1) << move);
 
-    if (move == CONTINUE || move == RETURN)
+    if (move == CONTINUE || move == RETURN) // the dice branch below a chance node, one roll per visit
     {
-        if (newState.getCurrentPlayerIndex() != node->state.getCurrentPlayerIndex())
-            newMovedThisTurn = false;
-        else
-            newMovedThisTurn = true;
+        auto chance = std::make_shared<MCTSNode>(node->state, move, numPlayers);
+        nodesCreated++;
+        node->children.push_back(chance);
+        node->childMoves.push_back(move);
+        path.push_back(chance.get());
+
+        chance->pendingRoll = node->state.getRules().roll(rng);
+        return expandRoll(chance.get());
     }
-    else
-        newMovedThisTurn = false;
 
-    auto child = std::make_unique<MCTSNode>(newState, node, move, newMovedThisTurn, numPlayers);
-    MCTSNode *childPtr = child.get();
-    node->children.push_back(std::move(child));
+    State newState = node->state.doMove(move);
+    node->children.push_back(newChild(newState, move, false));
+    node->childMoves.push_back(move);
+    path.push_back(node->children.back().get());
 
-    return childPtr;
+    return path.back();
 }
 
-std::vector<double> MCTS::simulate(MCTSNode *node)
+MCTSNode *MCTS::expandRoll(MCTSNode *chance)
 {
-    State simState = node->state;
-    bool movedThisTurn = node->movedThisTurn;
+    int roll = chance->pendingRoll;
+    chance->pendingRoll = 0;
 
-    int maxSteps = 100000;
-    int steps = 0;
+    MoveType move = chance->moveFromParent;
+    State newState = chance->state.doMove(move, roll);
+    bool newMovedThisTurn = newState.getCurrentPlayerIndex() == chance->state.getCurrentPlayerIndex();
 
-    while (!(simState.isTerminal() && simState.isLastRound()) && steps < maxSteps)
-    {
-        std::vector<MoveType> moves = simState.getPossibleMoves(movedThisTurn);
+    auto &slot = chance->children[roll - chance->state.getRules().minRoll()];
+    slot = newChild(newState, move, newMovedThisTurn);
+    path.push_back(slot.get());
 
-        if (moves.empty())
-            break;
+    return slot.get();
+}
 
-        if (moves[0] == END)
+// The node for a position just reached: the one already in the transposition table, if any
+std::shared_ptr<MCTSNode> MCTS::newChild(const State &state, MoveType move, bool movedThisTurn)
+{
+    uint64_t key = 0;
+    if (transpositions.enabled())
+    {
+        key = state.getHash(movedThisTurn);
+        if (MCTSNode *found = transpositions.find(state, movedThisTurn, key))
         {
-            simState = simState.doMove(END);
-            movedThisTurn = false;
-            steps++;
-            continue;
+            transpositionHits++;
+            return found->shared_from_this();
         }
+    }
 
-        MoveType move = getRandomMove(moves);
+    auto child = std::make_shared<MCTSNode>(state, move, movedThisTurn, numPlayers);
+    nodesCreated++;
+    if (transpositions.enabled())
+        transpositions.insert(key, child.get());
+    return child;
+}
 
-        int prevPlayer = simState.getCurrentPlayerIndex();
-        simState = simState.doMove(move);
-        int newPlayer = simState.getCurrentPlayerIndex();
+std::vector<double> MCTS::simulate(MCTSNode *node)
+{
+    scores.resize(rolloutsPerLeaf);
+    if (rolloutGroup)
+        rolloutGroup->run(node->state, node->movedThisTurn, rolloutsPerLeaf, rng, scores.data());
+    else
+        simulator.run(node->state, node->movedThisTurn, rolloutsPerLeaf, rng, scores.data());
 
-        if (move == CONTINUE || move == RETURN)
-        {
-            if (newPlayer != prevPlayer)
-                movedThisTurn = false;
-            else
-                movedThisTurn = true;
-        }
-        else
-            movedThisTurn = false;
+    std::vector<double> rewards(numPlayers, 0.0);
+    for (const ScoreVector &finalScores : scores)
+        addRewards(finalScores, rewards);
 
-        steps++;
-    }
+    for (int i = 0; i < numPlayers; i++)
+        rewards[i] /= rolloutsPerLeaf;
 
-    return getRewards(simState);
+    return rewards;
 }
 
-void MCTS::backpropagate(MCTSNode *node, const std::vector<double> &rewards)
+void MCTS::backpropagate(const std::vector<double> &rewards)
 {
-    while (node != nullptr)
+    for (MCTSNode *node : path)
     {
         node->visits++;
 
         for (int i = 0; i < numPlayers; i++)
             node->wins[i] += rewards[i];
-
-        node = node->parent;
     }
 }
 
-std::vector<double> MCTS::getRewards(const State &terminalState)
+// every player sharing the top score gets a win
+void MCTS::addRewards(const ScoreVector &finalScores, std::vector<double> &rewards)
 {
-    std::vector<double> rewards(numPlayers, 0.0);
-
-    int maxPoints = -1;
+    double maxPoints = -1;
     for (int i = 0; i < numPlayers; i++)
-    {
-        int points = terminalState.getPlayers()[i].getPoints();
-        if (points > maxPoints)
-            maxPoints = points;
-    }
+        if (finalScores[i] > maxPoints)
+            maxPoints = finalScores[i];
 
     for (int i = 0; i < numPlayers; i++)
-        if (terminalState.getPlayers()[i].getPoints() == maxPoints)
-            rewards[i] = 1.0;
-
-    return rewards;
-}
-
-MoveType MCTS::getRandomMove(const std::vector<MoveType> &moves)
-{
-    if (moves.empty())
-        return LEAVE_TREASURE;
-
-    std::uniform_int_distribution<size_t> dist(0, moves.size() - 1);
-    return moves[dist(rng)];
+        if (finalScores[i] == maxPoints)
+            rewards[i] += 1.0;
 }
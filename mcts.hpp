@@ -5,41 +5,86 @@
 #include <memory>
 #include <cmath>
 #include <limits>
-#include <random>
+#include <algorithm>
 #include "environment.hpp"
+#include "batch_rollout.hpp"
+#include "rollout_group.hpp"
+#include "transposition_table.hpp"
+#include "search_deadline.hpp"
 
 enum class NodeType
 {
-    DECISION,  
-    CHANCE     
+    DECISION, // a player picks the move
+    CHANCE    // CONTINUE or RETURN was picked and the dice decide; children are the rolls
 };
 
-class MCTSNode
+// With a transposition table a node may be reached from several parents, so nodes are shared
+// and carry no parent pointer; backpropagation follows the path the iteration selected.
+class MCTSNode : public std::enable_shared_from_this<MCTSNode>
 {
 public:
     State state;
-    MoveType moveFromParent;
-    MCTSNode *parent;
-    std::vector<std::unique_ptr<MCTSNode>> children;
+    MoveType moveFromParent; // the move of the parent that first created the node
+    std::vector<std::shared_ptr<MCTSNode>> children; // chance node: one slot per roll, minRoll first
+    std::vector<MoveType> childMoves;                // decision node: the move along each child's edge
 
     int visits = 0;
     std::vector<double> wins;  
 
-    std::vector<MoveType> unexpandedMoves;
+    MoveMask unexpandedMoves;
     bool movedThisTurn; 
 
     NodeType nodeType = NodeType::DECISION;
+    int pendingRoll = 0; // chance node: a sampled roll without a child yet
+    unsigned mark = 0;   // MCTS walks of the DAG: visited in the walk with this number
 
-    MCTSNode(const State &state, MCTSNode *parent, MoveType move, bool movedThisTurn, int numPlayers)
-        : state(state), moveFromParent(move), parent(parent), movedThisTurn(movedThisTurn)
+    MCTSNode(const State &state, MoveType move, bool movedThisTurn, int numPlayers)
+        : state(state), moveFromParent(move), movedThisTurn(movedThisTurn)
     {
         wins.resize(numPlayers, 0.0);
-        unexpandedMoves = state.getPossibleMoves(movedThisTurn);
+        unexpandedMoves = state.getPossibleMoves(movedThisTurn).mask();
+    }
+
+    // a chance node holds the state before the roll; `move` is the CONTINUE or RETURN to play
+    MCTSNode(const State &state, MoveType move, int numPlayers)
+        : state(state), moveFromParent(move), unexpandedMoves(0), movedThisTurn(false),
+          nodeType(NodeType::CHANCE)
+    {
+        wins.resize(numPlayers, 0.0);
+        const RulesConfig &rules = state.getRules();
+        children.resize(rules.maxRoll() - rules.minRoll() + 1);
     }
 
     bool isFullyExpanded() const
     {
-        return unexpandedMoves.empty();
+        return nodeType == NodeType::CHANCE ? pendingRoll == 0 : unexpandedMoves == 0;
+    }
+
+    MCTSNode *childForRoll(int roll) const
+    {
+        return children[roll - state.getRules().minRoll()].get();
+    }
+
+    // mean reward; a chance node weighs its rolls by their probability instead of by how
+    // often they happened to be sampled
+    double value(int playerIndex) const
+    {
+        if (nodeType == NodeType::DECISION)
+            return wins[playerIndex] / visits;
+
+        const RulesConfig &rules = state.getRules();
+        double sum = 0;
+        double weight = 0;
+        for (size_t i = 0; i < children.size(); i++)
+        {
+            const MCTSNode *child = children[i].get();
+            if (child == nullptr || child->visits == 0)
+                continue;
+            double probability = rules.rollProbability(rules.minRoll() + static_cast<int>(i));
+            sum += probability * child->wins[playerIndex] / child->visits;
+            weight += probability;
+        }
+        return weight > 0 ? sum / weight : wins[playerIndex] / visits;
     }
 
     bool isTerminal() const
@@ -47,13 +92,13 @@ public:
         return state.isTerminal() && state.isLastRound();
     }
 
-    double getUCB1(int playerIndex, double explorationConstant = 1.41) const
+    double getUCB1(int playerIndex, int parentVisits, double explorationConstant = 1.41) const
     {
         if (visits == 0)
             return std::numeric_limits<double>::infinity();
 
-        double exploitation = wins[playerIndex] / visits;
-        double exploration = explorationConstant * std::sqrt(std::log(parent->visits) / visits);
+        double exploitation = value(playerIndex);
+        double exploration = explorationConstant * std::sqrt(std::log(parentVisits) / visits);
 
         return exploitation + exploration;
     }
@@ -65,30 +110,131 @@ private:
     int numPlayers;
     int iterations;
     double explorationConstant;
+    ValuationPolicy valuation;
+    int rolloutsPerLeaf = 1;
+
+    RNG rng;
+    BatchRollout simulator;
+    std::unique_ptr<RolloutGroup> rolloutGroup; // plays the leaf rollouts instead, when set
+    std::vector<ScoreVector> scores;
+
+    // the last search tree, re-rooted onto the position the game actually reached
+    std::shared_ptr<MCTSNode> root;
+    int reusedVisits = 0;
+
+    TranspositionTable<MCTSNode> transpositions; // off unless sized by setTranspositions
+    std::vector<MCTSNode *> path;                // root to leaf of the current iteration
+    unsigned walk = 0;                           // numbers the walks that mark nodes
 
-    std::mt19937 rng;
+    int nodesCreated = 0;
+    int transpositionHits = 0;
+    int lastIterations = 0;
 
 public:
-    MCTS(int numPlayers, int iterations = 10000000, double explorationConstant = 1.41)
-        : numPlayers(numPlayers), iterations(iterations), explorationConstant(explorationConstant)
+    MCTS(int numPlayers, int iterations = 10000000, double explorationConstant = 1.41,
+         ValuationPolicy valuation = ValuationPolicy::MIDPOINT)
+        : numPlayers(numPlayers), iterations(iterations), explorationConstant(explorationConstant),
+          valuation(valuation), rng(RNG::local().split())
+    {
+    }
+
+    void setRng(const RNG &stream)
+    {
+        rng = stream;
+    }
+
+    // rollouts played from every expanded leaf; their rewards are averaged into one backup
+    void setRolloutsPerLeaf(int rollouts)
+    {
+        rolloutsPerLeaf = std::max(1, rollouts);
+    }
+
+    // Leaf parallelism: the `rollouts` of every expanded leaf are shared out over `workers`
+    // threads, this one included, and still averaged into one backup. The tree grows exactly
+    // as it would with setRolloutsPerLeaf(rollouts) alone; 1 worker plays them all here.
+    void setLeafParallelism(int rollouts, int workers)
+    {
+        setRolloutsPerLeaf(rollouts);
+        rolloutGroup.reset();
+        if (workers > 1)
+            rolloutGroup = std::make_unique<RolloutGroup>(workers);
+    }
+
+    int getRolloutsPerLeaf() const
     {
-        std::random_device rd;
-        rng = std::mt19937(rd());
+        return rolloutsPerLeaf;
     }
 
+    // Shares one node between transposing positions, finding them through a table of `entries`
+    // slots (0, the default, keeps a plain tree). Takes effect from the next search.
+    void setTranspositions(size_t entries)
+    {
+        transpositions.resize(entries);
+        root.reset();
+    }
+
+    // Searches until the root holds `iterations` visits. Visits already below the position
+    // from earlier calls count towards that budget.
     MoveType findBestMove(const State &state, int playerIndex, bool movedThisTurn);
 
+    // Searches until `budget` has passed instead (`iterations` still caps it), and sooner once
+    // the most visited move can no longer be overtaken in the time left.
+    MoveType findBestMove(const State &state, int playerIndex, bool movedThisTurn, std::chrono::milliseconds budget);
+
+    // iterations run by the last findBestMove, reused visits not counted
+    int getLastIterations() const
+    {
+        return lastIterations;
+    }
+
+    // root visits carried over from earlier searches by the last findBestMove
+    int getReusedVisits() const
+    {
+        return reusedVisits;
+    }
+
+    void clearTree()
+    {
+        root.reset();
+        transpositions.clear();
+    }
+
+    // nodes allocated by the last findBestMove, and expansions that found their position
+    // already in the table instead
+    int getNodesCreated() const
+    {
+        return nodesCreated;
+    }
+
+    int getTranspositionHits() const
+    {
+        return transpositionHits;
+    }
+
+    const MCTSNode *getRoot() const // the last search tree, for inspection
+    {
+        return root.get();
+    }
+
 private:
+    MoveType search(const State &state, bool movedThisTurn, const SearchDeadline &deadline);
+    void iterate();
+    bool isDecided(long remaining) const;
+
+    void reroot(const State &state, bool movedThisTurn);
+    MCTSNode *findNode(MCTSNode *node, const State &state, uint64_t hash, bool movedThisTurn);
+    void indexTree(MCTSNode *node);
+    std::shared_ptr<MCTSNode> newChild(const State &state, MoveType move, bool movedThisTurn);
+
     MCTSNode *select(MCTSNode *node);
     MCTSNode *expand(MCTSNode *node);
+    MCTSNode *expandRoll(MCTSNode *chance);
     std::vector<double> simulate(MCTSNode *node);
-    void backpropagate(MCTSNode *node, const std::vector<double> &rewards);
+    void backpropagate(const std::vector<double> &rewards);
 
     MCTSNode *selectBestChild(MCTSNode *node);
 
-    std::vector<double> getRewards(const State &terminalState);
-
-    MoveType getRandomMove(const std::vector<MoveType> &moves);
+    void addRewards(const ScoreVector &finalScores, std::vector<double> &rewards);
 };
 
 #endif // MCTS_HPP
@@ -6,30 +6,113 @@
 #include <numeric>
 #include <unordered_map>
 
-std::vector<MoveStats> MCTSWorker::search(const State &state, int playerIndex, bool movedThisTurn)
+ParallelMCTSNode *NodePool::compact(ParallelMCTSNode *root)
 {
-    pool.reset();
+    constexpr uint32_t UNSEEN = UINT32_MAX; // shared nodes are reached more than once
+    remap.assign(nextNode, UNSEEN);
 
-    ParallelMCTSNode *root = pool.allocateNode();
-    root->init(state, nullptr, LEAVE_TREASURE, movedThisTurn, numPlayers);
+    kept.clear();
+    kept.push_back(indexOf(root));
+    remap[kept[0]] = 0;
+    for (size_t i = 0; i < kept.size(); i++)
+    {
+        const ParallelMCTSNode &node = nodes[kept[i]];
+        for (int c = 0; c < node.childCount; c++)
+        {
+            if (node.children[c] == nullptr)
+                continue;
+            uint32_t index = indexOf(node.children[c]);
+            if (remap[index] == UNSEEN)
+            {
+                remap[index] = 0;
+                kept.push_back(index);
+            }
+        }
+    }
+
+    // in allocation order every node moves down (or stays), never onto one not yet moved
+    std::sort(kept.begin(), kept.end());
+    for (size_t i = 0; i < kept.size(); i++)
+        remap[kept[i]] = static_cast<uint32_t>(i);
+
+    // child blocks were handed out in node order too, so they also only move down; a block
+    // may overlap its own old place, but each slot is read before it is written
+    size_t block = 0;
+    for (size_t i = 0; i < kept.size(); i++)
+    {
+        ParallelMCTSNode &from = nodes[kept[i]];
+        ParallelMCTSNode &to = nodes[i];
+        ParallelMCTSNode **children = &childArrayPool[block];
+        block += from.childCapacity;
 
-    for (int i = 0; i < iterations; i++)
+        for (int c = 0; c < from.childCount; c++)
+            children[c] = from.children[c] ? &nodes[remap[indexOf(from.children[c])]] : nullptr;
+
+        if (&to != &from)
+            to = from;
+        to.children = children;
+    }
+
+    nextNode = kept.size();
+    nextChildArray = block;
+    return &nodes[remap[indexOf(root)]];
+}
+
+ParallelMCTSNode *NodePool::grow(ParallelMCTSNode *root)
+{
+    // node and slot indices survive the move; the old addresses are only compared as integers
+    uintptr_t oldNodes = reinterpret_cast<uintptr_t>(nodes.data());
+    uintptr_t oldSlots = reinterpret_cast<uintptr_t>(childArrayPool.data());
+    auto nodeIndex = [oldNodes](const ParallelMCTSNode *node)
+    { return (reinterpret_cast<uintptr_t>(node) - oldNodes) / sizeof(ParallelMCTSNode); };
+
+    nodes.resize(nodes.size() * 2);
+    childArrayPool.resize(childArrayPool.size() * 2);
+
+    for (size_t i = 0; i < nextNode; i++)
     {
-        ParallelMCTSNode *selected = select(root);
+        ParallelMCTSNode &node = nodes[i];
+        node.children = &childArrayPool[(reinterpret_cast<uintptr_t>(node.children) - oldSlots) / sizeof(ParallelMCTSNode *)];
+        for (int c = 0; c < node.childCount; c++)
+            if (node.children[c] != nullptr)
+                node.children[c] = &nodes[nodeIndex(node.children[c])];
+    }
 
-        ParallelMCTSNode *expanded = selected;
-        if (!selected->isTerminal() && !selected->unexpandedMoves.empty())
-            expanded = expand(selected);
+    return &nodes[nodeIndex(root)];
+}
+
+std::vector<MoveStats> MCTSWorker::search(const State &state, int playerIndex, bool movedThisTurn,
+                                          const SearchDeadline &deadline)
+{
+    State rootState = state;
+    rootState.setValuationPolicy(valuation); // simulated round ends never touch the real value pools
+    rootState.setRng(&rng);
 
-        std::array<double, MAX_PLAYERS> rewards = simulate(expanded);
-        backpropagate(expanded, rewards);
+    nodesCreated = 0;
+    transpositionHits = 0;
+    reroot(rootState, movedThisTurn);
+
+    int i = reusedVisits;
+    while (i < iterations)
+    {
+        int batchEnd = deadline.isTimed() ? std::min(iterations, i + SearchDeadline::CHECK_INTERVAL) : iterations;
+        for (; i < batchEnd; i++)
+            iterate();
+
+        if (deadline.isTimed())
+        {
+            long remaining = std::min<long>(iterations - i, deadline.remainingIterations(i - reusedVisits));
+            if (remaining == 0 || isDecided(remaining))
+                break;
+        }
     }
+    lastIterations = std::max(0, i - reusedVisits);
 
     std::vector<MoveStats> results;
     for (int i = 0; i < root->childCount; i++)
     {
         ParallelMCTSNode *child = root->children[i];
-        MoveStats stats(child->moveFromParent);
+        MoveStats stats(root->childMoves[i]); // a shared child may have been created by another parent's move
         stats.totalVisits = child->visits;
         stats.totalWins = child->wins[playerIndex];
         results.push_back(stats);
@@ -38,10 +121,127 @@ std::vector<MoveStats> MCTSWorker::search(const State &state, int playerIndex, b
     return results;
 }
 
+void MCTSWorker::iterate()
+{
+    // an iteration adds at most a chance node and the decision node of its roll
+    const RulesConfig &rules = root->state.getRules();
+    if (!pool.hasRoom(2, rules.maxRoll() - rules.minRoll() + 1 + NodePool::CHILD_ARRAY_SIZE))
+    {
+        root = pool.grow(root);
+        if (transpositions.enabled())
+            indexPool();
+    }
+
+    ParallelMCTSNode *selected = select(root);
+
+    ParallelMCTSNode *expanded = selected;
+    if (!selected->isTerminal() && !selected->isFullyExpanded())
+        expanded = expand(selected);
+
+    std::array<double, MAX_PLAYERS> rewards = simulate(expanded);
+    backpropagate(rewards);
+}
+
+bool MCTSWorker::isDecided(long remaining) const
+{
+    int best = 0;
+    int second = 0;
+    for (int i = 0; i < root->childCount; i++)
+    {
+        int visits = root->children[i]->visits;
+        if (visits > best)
+        {
+            second = best;
+            best = visits;
+        }
+        else if (visits > second)
+        {
+            second = visits;
+        }
+    }
+    return SearchDeadline::isDecided(best, second, remaining);
+}
+
+// MCTS::reroot over the node pool: the kept subtree is compacted to the front of the pool
+void MCTSWorker::reroot(const State &state, bool movedThisTurn)
+{
+    walk++;
+    ParallelMCTSNode *found = root ? findNode(root, state, state.getHash(movedThisTurn), movedThisTurn) : nullptr;
+
+    if (found == nullptr)
+    {
+        pool.reset();
+        root = pool.allocateNode();
+        root->init(state, LEAVE_TREASURE, movedThisTurn, numPlayers);
+        nodesCreated++;
+    }
+    else if (found != root)
+    {
+        root = pool.compact(found);
+    }
+
+    if (transpositions.enabled())
+        indexPool();
+
+    reusedVisits = root->visits;
+}
+
+// every node left in the pool is in the tree, so the table is rebuilt from the pool
+void MCTSWorker::indexPool()
+{
+    transpositions.clear();
+    for (size_t i = 0; i < pool.getUsedNodes(); i++)
+    {
+        ParallelMCTSNode &node = pool[i];
+        if (node.nodeType == NodeType::DECISION)
+            transpositions.insert(node.state.getHash(node.movedThisTurn), &node);
+    }
+}
+
+ParallelMCTSNode *MCTSWorker::findNode(ParallelMCTSNode *node, const State &state, uint64_t hash, bool movedThisTurn)
+{
+    if (node->mark == walk)
+        return nullptr;
+    node->mark = walk;
+
+    const State &candidate = node->state;
+    if (node->nodeType == NodeType::DECISION && candidate.getHash(node->movedThisTurn) == hash &&
+        node->movedThisTurn == movedThisTurn && candidate == state)
+        return node;
+
+    if (candidate.getCurrentRound() > state.getCurrentRound() ||
+        (candidate.getCurrentRound() == state.getCurrentRound() && candidate.getOxygen() < state.getOxygen()))
+        return nullptr;
+
+    for (int i = 0; i < node->childCount; i++)
+        if (node->children[i] != nullptr)
+            if (ParallelMCTSNode *match = findNode(node->children[i], state, hash, movedThisTurn))
+                return match;
+
+    return nullptr;
+}
+
 ParallelMCTSNode *MCTSWorker::select(ParallelMCTSNode *node)
 {
+    path.clear();
+    path.push_back(node);
+
     while (!node->isTerminal())
     {
+        if (node->nodeType == NodeType::CHANCE)
+        {
+            int roll = node->state.getRules().roll(rng);
+            ParallelMCTSNode *outcome = node->childForRoll(roll);
+            if (outcome == nullptr)
+            {
+                node->pendingRoll = roll;
+                return node;
+            }
+            node = outcome;
+            path.push_back(node);
+            continue;
+        }
+
         if (!node->isFullyExpanded())
             return node;
 
@@ -49,6 +249,7 @@ ParallelMCTSNode *MCTSWorker::select(ParallelMCTSNode *node)
             return node;
 
         node = selectBestChild(node);
+        path.push_back(node);
     }
 
     return node;
@@ -79,190 +280,489 @@ ParallelMCTSNode *MCTSWorker::selectBestChild(ParallelMCTSNode *node)
 
 ParallelMCTSNode *MCTSWorker::expand(ParallelMCTSNode *node)
 {
-    if (node->unexpandedMoves.empty())
+    if (node->isFullyExpanded())
         return node;
 
-    size_t moveIndex;
-    if (node->unexpandedMoves.size() == 1)
+    if (node->nodeType == NodeType::CHANCE)
+        return expandRoll(node);
+
+    int untried = countMoves(node->unexpandedMoves);
+    int moveIndex;
+    if (untried == 1)
     {
         moveIndex = 0;
     }
     else
     {
-        dist.param(std::uniform_int_distribution<size_t>::param_type(0, node->unexpandedMoves.size() - 1));
-        moveIndex = dist(rng);
+        moveIndex = static_cast<int>(rng.below(untried));
     }
 
-    MoveType move = node->unexpandedMoves[moveIndex];
+    MoveType move = nthMove(node->unexpandedMoves, moveIndex);
+    node->unexpandedMoves &= ~(MoveMask(1) << move);
 
-    if (moveIndex != node->unexpandedMoves.size() - 1)
-        std::swap(node->unexpandedMoves[moveIndex], node->unexpandedMoves.back());
-    node->unexpandedMoves.pop_back();
+    if (move == CONTINUE || move == RETURN) // the dice branch below a chance node, one roll per visit
+    {
+        const RulesConfig &rules = node->state.getRules();
+        ParallelMCTSNode *chance = pool.allocateNode(rules.maxRoll() - rules.minRoll() + 1);
+        chance->initChance(node->state, move, numPlayers);
+        nodesCreated++;
+        node->childMoves[node->childCount] = move;
+        node->children[node->childCount++] = chance;
+        path.push_back(chance);
+
+        chance->pendingRoll = rules.roll(rng);
+        return expandRoll(chance);
+    }
 
     State newState = node->state.doMove(move);
 
-    bool newMovedThisTurn;
-    if (move == CONTINUE || move == RETURN)
-    {
-        newMovedThisTurn = (newState.getCurrentPlayerIndex() == node->state.getCurrentPlayerIndex());
-    }
-    else
+    ParallelMCTSNode *child = newChild(newState, move, false);
+
+    if (node->childCount < node->childCapacity)
     {
-        newMovedThisTurn = false;
+        node->childMoves[node->childCount] = move;
+        node->children[node->childCount++] = child;
     }
 
-    ParallelMCTSNode *child = pool.allocateNode();
-    child->init(newState, node, move, newMovedThisTurn, numPlayers);
+    path.push_back(child);
+    return child;
+}
 
-    if (node->childCount < node->childCapacity)
+ParallelMCTSNode *MCTSWorker::expandRoll(ParallelMCTSNode *chance)
+{
+    int roll = chance->pendingRoll;
+    chance->pendingRoll = 0;
+
+    MoveType move = chance->moveFromParent;
+    State newState = chance->state.doMove(move, roll);
+    bool newMovedThisTurn = newState.getCurrentPlayerIndex() == chance->state.getCurrentPlayerIndex();
+
+    ParallelMCTSNode *child = newChild(newState, move, newMovedThisTurn);
+    chance->children[roll - chance->state.getRules().minRoll()] = child;
+
+    path.push_back(child);
+    return child;
+}
+
+// as MCTS::newChild
+ParallelMCTSNode *MCTSWorker::newChild(const State &state, MoveType move, bool movedThisTurn)
+{
+    uint64_t key = 0;
+    if (transpositions.enabled())
     {
-        node->children[node->childCount++] = child;
+        key = state.getHash(movedThisTurn);
+        if (ParallelMCTSNode *found = transpositions.find(state, movedThisTurn, key))
+        {
+            transpositionHits++;
+            return found;
+        }
     }
 
+    ParallelMCTSNode *child = pool.allocateNode();
+    child->init(state, move, movedThisTurn, numPlayers);
+    nodesCreated++;
+    if (transpositions.enabled())
+        transpositions.insert(key, child);
     return child;
 }
 
+// cautious random playouts: no third stack, nor one the oxygen cannot bring home
 std::array<double, MAX_PLAYERS> MCTSWorker::simulate(ParallelMCTSNode *node)
 {
-    State simState = node->state;
-    bool movedThisTurn = node->movedThisTurn;
+    scores.resize(rolloutsPerLeaf);
+    simulator.run(node->state, node->movedThisTurn, rolloutsPerLeaf, rng, scores.data());
 
-    int maxSteps = 500;
-    int steps = 0;
+    std::array<double, MAX_PLAYERS> rewards;
+    rewards.fill(0.0);
+    for (const ScoreVector &finalScores : scores)
+        addRewards(finalScores, rewards);
+
+    for (int i = 0; i < numPlayers; i++)
+        rewards[i] /= rolloutsPerLeaf;
+
+    return rewards;
+}
 
-    while (!(simState.isTerminal() && simState.isLastRound()) && steps < maxSteps)
+void MCTSWorker::backpropagate(const std::array<double, MAX_PLAYERS> &rewards)
+{
+    for (ParallelMCTSNode *node : path)
     {
-        std::vector<MoveType> moves = simState.getPossibleMoves(movedThisTurn);
+        node->visits++;
+        node->updateLogVisits();
 
-        if (moves.empty())
-            break;
+        for (int i = 0; i < numPlayers; i++)
+            node->wins[i] += rewards[i];
+    }
+}
 
-        if (moves[0] == END)
-        {
-            simState = simState.doMove(END);
-            movedThisTurn = false;
-            steps++;
-            continue;
-        }
+// scores rescaled to [0, 1] between the last and the leader
+static void addNormalizedRewards(const ScoreVector &finalScores, int numPlayers, std::array<double, MAX_PLAYERS> &rewards)
+{
+    double maxScore = 0;
+    double minScore = std::numeric_limits<double>::max();
 
-        const Player &currentPlayer = simState.getPlayers()[simState.getCurrentPlayerIndex()];
-        int treasureCount = static_cast<int>(const_cast<Player &>(currentPlayer).getTreasures().size());
-        int position = currentPlayer.getPosition();
-        int oxygen = simState.getOxygen();
+    for (int i = 0; i < numPlayers; i++)
+    {
+        maxScore = std::max(maxScore, finalScores[i]);
+        minScore = std::min(minScore, finalScores[i]);
+    }
 
-        if (treasureCount >= 2)
-        {
-            auto it = std::find(moves.begin(), moves.end(), COLLECT_TREASURE);
-            if (it != moves.end())
-                moves.erase(it);
+    double scoreRange = maxScore - minScore;
 
-            if (oxygen < position)
-            {
-                auto dropIt = std::find(moves.begin(), moves.end(), DROP_TREASURE);
-                if (dropIt != moves.end())
-                {
-                    moves = {DROP_TREASURE};
-                }
-            }
-        }
-        else if (treasureCount == 1)
+    if (scoreRange == 0)
+    {
+        double equalReward = 1.0 / numPlayers;
+        for (int i = 0; i < numPlayers; i++)
+            rewards[i] += equalReward;
+    }
+    else
+    {
+        for (int i = 0; i < numPlayers; i++)
         {
-            if (oxygen <= position)
-            {
-                auto it = std::find(moves.begin(), moves.end(), COLLECT_TREASURE);
-                if (it != moves.end())
-                    moves.erase(it);
-            }
+            rewards[i] += (finalScores[i] - minScore) / scoreRange;
         }
+    }
+}
 
-        if (moves.empty())
-            moves.push_back(LEAVE_TREASURE);
+void MCTSWorker::addRewards(const ScoreVector &finalScores, std::array<double, MAX_PLAYERS> &rewards)
+{
+    addNormalizedRewards(finalScores, numPlayers, rewards);
+}
 
-        MoveType move = getRandomMove(moves);
+static void atomicAdd(std::atomic<double> &target, double value)
+{
+    double current = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+    {
+    }
+}
 
-        int prevPlayer = simState.getCurrentPlayerIndex();
-        simState = simState.doMove(move);
-        int newPlayer = simState.getCurrentPlayerIndex();
+std::pair<SharedTreeNode *, std::atomic<SharedTreeNode *> *> SharedNodeArena::allocate(Cursor &cursor, int childSlots)
+{
+    used.fetch_add(1, std::memory_order_relaxed);
+    if (cursor.spare != nullptr && childSlots == SharedTreeNode::MOVE_SLOTS)
+    {
+        SharedTreeNode *node = cursor.spare;
+        cursor.spare = nullptr;
+        return {node, node->children};
+    }
 
-        if (move == CONTINUE || move == RETURN)
+    if (cursor.node == cursor.nodeEnd || cursor.slotEnd - cursor.slot < childSlots)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (cursor.node == cursor.nodeEnd)
         {
-            movedThisTurn = (newPlayer == prevPlayer);
+            if (nodeChunksTaken == nodeChunks.size())
+                nodeChunks.push_back(std::make_unique<SharedTreeNode[]>(CHUNK_NODES));
+            cursor.node = nodeChunks[nodeChunksTaken++].get();
+            cursor.nodeEnd = cursor.node + CHUNK_NODES;
         }
-        else
+        if (cursor.slotEnd - cursor.slot < childSlots)
         {
-            movedThisTurn = false;
+            if (slotChunksTaken == slotChunks.size())
+                slotChunks.push_back(std::make_unique<std::atomic<SharedTreeNode *>[]>(CHUNK_SLOTS));
+            cursor.slot = slotChunks[slotChunksTaken++].get();
+            cursor.slotEnd = cursor.slot + CHUNK_SLOTS;
         }
-
-        steps++;
     }
 
-    return getRewards(simState);
+    SharedTreeNode *node = cursor.node++;
+    std::atomic<SharedTreeNode *> *slots = cursor.slot;
+    cursor.slot += childSlots;
+    return {node, slots};
+}
+
+void SharedNodeArena::recycle(Cursor &cursor, SharedTreeNode *node)
+{
+    used.fetch_sub(1, std::memory_order_relaxed);
+    cursor.spare = node; // a thread loses at most one race between two allocations
+}
+
+void SharedNodeArena::reset()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    nodeChunksTaken = 0;
+    slotChunksTaken = 0;
+    used = 0;
 }
 
-void MCTSWorker::backpropagate(ParallelMCTSNode *node, const std::array<double, MAX_PLAYERS> &rewards)
+std::vector<MoveStats> SharedTreeSearch::search(const State &state, int playerIndex, bool movedThisTurn,
+                                                const SearchDeadline &deadline)
 {
-    while (node != nullptr)
+    State rootState = state;
+    rootState.setValuationPolicy(valuation); // simulated round ends never touch the real value pools
+
+    arena.reset();
+    claimed = 0;
+    completed = 0;
+    stopped = false;
+
+    std::vector<std::unique_ptr<Context>> contexts;
+    for (int t = 0; t < numThreads; t++)
     {
-        node->visits++;
-        node->updateLogVisits();
+        contexts.push_back(std::make_unique<Context>());
+        contexts.back()->rng = rng.split();
+    }
+    root = newNode(rootState, LEAVE_TREASURE, movedThisTurn, NodeType::DECISION, *contexts[0]);
 
-        for (int i = 0; i < numPlayers; i++)
-            node->wins[i] += rewards[i];
+    std::vector<std::thread> threads;
+    for (int t = 1; t < numThreads; t++)
+        threads.emplace_back([this, &contexts, t, &deadline]()
+                             { run(*contexts[t], deadline); });
+    run(*contexts[0], deadline);
+    for (auto &thread : threads)
+        thread.join();
+
+    std::vector<MoveStats> results;
+    for (int i = 0; i < root->slotCount; i++)
+    {
+        SharedTreeNode *child = root->child(i);
+        if (child == nullptr)
+            continue;
+        MoveStats stats(child->moveFromParent);
+        stats.totalVisits = child->visits.load();
+        stats.totalWins = child->wins[playerIndex].load();
+        results.push_back(stats);
+    }
+    return results;
+}
 
-        node = node->parent;
+void SharedTreeSearch::run(Context &ctx, const SearchDeadline &deadline)
+{
+    int done = 0;
+    while (!stopped.load(std::memory_order_relaxed) && claimed.fetch_add(1, std::memory_order_relaxed) < iterations)
+    {
+        iterate(ctx);
+        completed.fetch_add(1, std::memory_order_relaxed);
+
+        if (deadline.isTimed() && ++done % SearchDeadline::CHECK_INTERVAL == 0)
+        {
+            int total = completed.load(std::memory_order_relaxed);
+            long remaining = std::min<long>(iterations - total, deadline.remainingIterations(total));
+            if (remaining <= 0 || isDecided(remaining))
+                stopped.store(true, std::memory_order_relaxed);
+        }
     }
 }
 
-std::array<double, MAX_PLAYERS> MCTSWorker::getRewards(const State &terminalState)
+void SharedTreeSearch::iterate(Context &ctx)
 {
+    ctx.path.clear();
+    SharedTreeNode *node = root;
+    node->virtualLoss.fetch_add(1, std::memory_order_relaxed);
+    ctx.path.push_back(node);
+
+    while (!node->isTerminal())
+    {
+        bool created = false;
+        SharedTreeNode *next = nullptr;
+
+        if (node->nodeType == NodeType::CHANCE)
+        {
+            int roll = node->state.getRules().roll(ctx.rng);
+            next = node->slotForRoll(roll).load(std::memory_order_acquire);
+            if (next == nullptr)
+                next = expandRoll(node, roll, ctx, created);
+        }
+        else
+        {
+            if (node->unexpandedMoves.load(std::memory_order_relaxed) != 0)
+            {
+                next = expand(node, ctx); // null when other threads claimed the last untried moves
+                created = next != nullptr && next->nodeType == NodeType::DECISION;
+            }
+            if (next == nullptr)
+                next = selectBestChild(node);
+            if (next == nullptr) // every move is claimed but none is published yet: a leaf for now
+                break;
+        }
+
+        next->virtualLoss.fetch_add(1, std::memory_order_relaxed);
+        ctx.path.push_back(next);
+        node = next;
+
+        if (created)
+            break;
+    }
+
+    // the rollouts run from the state alone, so the thread's own RNG drives them
+    ctx.scores.resize(rolloutsPerLeaf);
+    ctx.simulator.run(node->state, node->movedThisTurn, rolloutsPerLeaf, ctx.rng, ctx.scores.data());
+
     std::array<double, MAX_PLAYERS> rewards;
     rewards.fill(0.0);
+    for (const ScoreVector &finalScores : ctx.scores)
+        addNormalizedRewards(finalScores, numPlayers, rewards);
 
-    const auto &players = terminalState.getPlayers();
+    for (SharedTreeNode *visited : ctx.path)
+    {
+        for (int i = 0; i < numPlayers; i++)
+            atomicAdd(visited->wins[i], rewards[i] / rolloutsPerLeaf);
+        visited->visits.fetch_add(1, std::memory_order_relaxed);
+        visited->virtualLoss.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
 
-    std::array<int, MAX_PLAYERS> scores;
-    int maxScore = 0;
-    int minScore = std::numeric_limits<int>::max();
+SharedTreeNode *SharedTreeSearch::newNode(const State &state, MoveType move, bool movedThisTurn, NodeType type,
+                                          Context &ctx)
+{
+    auto [node, children] = arena.allocate(ctx.cursor, SharedTreeNode::slotsFor(state.getRules(), type));
+    node->init(state, move, movedThisTurn, type, children);
+    return node;
+}
 
-    for (int i = 0; i < numPlayers; i++)
+// Installs a finished child in an empty slot. Returns the node that holds the slot: the child,
+// or the one another thread published first, in which case the child goes back to the arena.
+SharedTreeNode *SharedTreeSearch::publish(std::atomic<SharedTreeNode *> &slot, SharedTreeNode *child, Context &ctx,
+                                          bool &created)
+{
+    SharedTreeNode *published = nullptr;
+    if (slot.compare_exchange_strong(published, child, std::memory_order_acq_rel, std::memory_order_acquire))
     {
-        scores[i] = players[i].getPoints();
-        maxScore = std::max(maxScore, scores[i]);
-        minScore = std::min(minScore, scores[i]);
+        created = true;
+        return child;
     }
 
-    int scoreRange = maxScore - minScore;
+    arena.recycle(ctx.cursor, child);
+    return published;
+}
+
+// Claims one untried move of a decision node and adds it: a chance node for CONTINUE and RETURN,
+// whose roll the caller then picks, or the child the move leads to
+SharedTreeNode *SharedTreeSearch::expand(SharedTreeNode *node, Context &ctx)
+{
+    MoveMask untried = node->unexpandedMoves.load(std::memory_order_relaxed);
+    MoveType move;
+    do
+    {
+        if (untried == 0)
+            return nullptr;
+        move = nthMove(untried, ctx.rng.below(countMoves(untried)));
+    } while (!node->unexpandedMoves.compare_exchange_weak(untried, untried & ~(MoveMask(1) << move),
+                                                          std::memory_order_relaxed));
 
-    if (scoreRange == 0)
+    SharedTreeNode *child;
+    if (move == CONTINUE || move == RETURN)
     {
-        double equalReward = 1.0 / numPlayers;
-        for (int i = 0; i < numPlayers; i++)
-            rewards[i] = equalReward;
+        child = newNode(node->state, move, false, NodeType::CHANCE, ctx);
     }
     else
     {
-        for (int i = 0; i < numPlayers; i++)
+        ctx.scratch = node->state;
+        ctx.scratch.setRng(&ctx.rng);
+        child = newNode(ctx.scratch.doMove(move), move, false, NodeType::DECISION, ctx);
+    }
+
+    bool created = false;
+    return publish(node->children[move], child, ctx, created); // the claim is ours, so the slot is empty
+}
+
+SharedTreeNode *SharedTreeSearch::expandRoll(SharedTreeNode *chance, int roll, Context &ctx, bool &created)
+{
+    MoveType move = chance->moveFromParent;
+    ctx.scratch = chance->state;
+    ctx.scratch.setRng(&ctx.rng);
+    State next = ctx.scratch.doMove(move, roll);
+    bool moved = next.getCurrentPlayerIndex() == chance->state.getCurrentPlayerIndex();
+
+    SharedTreeNode *child = newNode(next, move, moved, NodeType::DECISION, ctx);
+    return publish(chance->slotForRoll(roll), child, ctx, created);
+}
+
+// UCB1 over visits that count the threads still below a child as losses; null while no child
+// is published
+SharedTreeNode *SharedTreeSearch::selectBestChild(SharedTreeNode *node) const
+{
+    int currentPlayer = node->state.getCurrentPlayerIndex();
+    double parentVisits = node->visits.load(std::memory_order_relaxed) + node->virtualLoss.load(std::memory_order_relaxed);
+    double logParent = std::log(std::max(1.0, parentVisits));
+
+    SharedTreeNode *best = nullptr;
+    double bestScore = -std::numeric_limits<double>::infinity();
+
+    for (int i = 0; i < node->slotCount; i++)
+    {
+        SharedTreeNode *child = node->child(i);
+        if (child == nullptr)
+            continue;
+
+        int visits = child->visits.load(std::memory_order_relaxed);
+        int pending = child->virtualLoss.load(std::memory_order_relaxed);
+        double score;
+        if (visits + pending == 0)
+        {
+            score = std::numeric_limits<double>::infinity();
+        }
+        else
+        {
+            double exploitation = visits > 0 ? child->value(currentPlayer) * visits / (visits + pending) : 0.0;
+            score = exploitation + explorationConstant * std::sqrt(logParent / (visits + pending));
+        }
+
+        if (score > bestScore)
         {
-            rewards[i] = static_cast<double>(scores[i] - minScore) / scoreRange;
+            bestScore = score;
+            best = child;
         }
     }
 
-    return rewards;
+    return best;
 }
 
-MoveType MCTSWorker::getRandomMove(const std::vector<MoveType> &moves)
+bool SharedTreeSearch::isDecided(long remaining) const
 {
-    if (moves.empty())
-        return LEAVE_TREASURE;
+    int best = 0;
+    int second = 0;
+    for (int i = 0; i < root->slotCount; i++)
+    {
+        SharedTreeNode *child = root->child(i);
+        int visits = child ? child->visits.load(std::memory_order_relaxed) : 0;
+        if (visits > best)
+        {
+            second = best;
+            best = visits;
+        }
+        else if (visits > second)
+        {
+            second = visits;
+        }
+    }
+    return SearchDeadline::isDecided(best, second, remaining);
+}
 
-    if (moves.size() == 1)
-        return moves[0];
+MoveType ParallelMCTS::findBestMove(const State &state, int playerIndex, bool movedThisTurn)
+{
+    return search(state, playerIndex, movedThisTurn, SearchDeadline());
+}
 
-    dist.param(std::uniform_int_distribution<size_t>::param_type(0, moves.size() - 1));
-    return moves[dist(rng)];
+MoveType ParallelMCTS::findBestMove(const State &state, int playerIndex, bool movedThisTurn,
+                                    std::chrono::milliseconds budget)
+{
+    prepare(); // the budget is for searching, not for allocating the workers' pools
+    return search(state, playerIndex, movedThisTurn, SearchDeadline(budget));
 }
 
-MoveType ParallelMCTS::findBestMove(const State &state, int playerIndex, bool movedThisTurn)
+void ParallelMCTS::prepare()
+{
+    if (mode == ParallelMode::TREE)
+    {
+        if (!sharedTree)
+            sharedTree = std::make_unique<SharedTreeSearch>(numPlayers, iterationsPerThread * numThreads, numThreads,
+                                                            explorationConstant, valuation, rng.split(),
+                                                            rolloutsPerLeaf);
+        return;
+    }
+
+    if (workers.empty())
+        for (int t = 0; t < numThreads; t++)
+        {
+            workers.push_back(std::make_unique<MCTSWorker>(numPlayers, iterationsPerThread, explorationConstant,
+                                                           valuation, rng.split(), rolloutsPerLeaf));
+            workers.back()->setTranspositions(transpositionEntries);
+        }
+}
+
+MoveType ParallelMCTS::search(const State &state, int playerIndex, bool movedThisTurn, const SearchDeadline &deadline)
 {
     auto moves = state.getPossibleMoves(movedThisTurn);
 
@@ -278,19 +778,25 @@ MoveType ParallelMCTS::findBestMove(const State &state, int playerIndex, bool mo
     // std::cerr << "[ParallelMCTS] Running " << (iterationsPerThread * numThreads)
     //           << " iterations across " << numThreads << " threads...\n";
 
-    Tile::useDeterministicValues = true;
-
-    std::vector<std::future<std::vector<MoveStats>>> futures;
-    std::random_device rd;
+    std::vector<std::vector<MoveStats>> searched;
 
-    for (int t = 0; t < numThreads; t++)
+    prepare();
+    if (mode == ParallelMode::TREE)
+    {
+        searched.push_back(sharedTree->search(state, playerIndex, movedThisTurn, deadline));
+    }
+    else
     {
-        unsigned int seed = rd() ^ (t * 0x9E3779B9);
+        std::vector<std::future<std::vector<MoveStats>>> futures;
 
-        futures.push_back(std::async(std::launch::async, [=]()
-                                     {
-            MCTSWorker worker(numPlayers, iterationsPerThread, explorationConstant, seed);
-            return worker.search(state, playerIndex, movedThisTurn); }));
+        for (auto &worker : workers)
+        {
+            futures.push_back(std::async(std::launch::async, [&worker, &state, playerIndex, movedThisTurn, &deadline]()
+                                         { return worker->search(state, playerIndex, movedThisTurn, deadline); }));
+        }
+
+        for (auto &future : futures)
+            searched.push_back(future.get());
     }
 
     std::unordered_map<MoveType, MoveStats> aggregated;
@@ -300,9 +806,8 @@ MoveType ParallelMCTS::findBestMove(const State &state, int playerIndex, bool mo
         aggregated[m] = MoveStats(m);
     }
 
-    for (auto &future : futures)
+    for (const auto &workerStats : searched)
     {
-        std::vector<MoveStats> workerStats = future.get();
         for (const auto &stat : workerStats)
         {
             aggregated[stat.move].totalVisits += stat.totalVisits;
@@ -310,8 +815,6 @@ MoveType ParallelMCTS::findBestMove(const State &state, int playerIndex, bool mo
         }
     }
 
-    Tile::useDeterministicValues = false;
-
     MoveType bestMove = LEAVE_TREASURE;
     int bestVisits = -1;
     double bestWinRate = -1.0;
@@ -360,3 +863,41 @@ MoveType ParallelMCTS::findBestMove(const State &state, int playerIndex, bool mo
 
     return bestMove;
 }
+
+int ParallelMCTS::getLastIterations() const
+{
+    if (mode == ParallelMode::TREE)
+        return sharedTree ? sharedTree->getLastIterations() : 0;
+
+    int total = 0;
+    for (const auto &worker : workers)
+        total += worker->getLastIterations();
+    return total;
+}
+
+int ParallelMCTS::getNodesCreated() const
+{
+    if (mode == ParallelMode::TREE)
+        return sharedTree ? static_cast<int>(sharedTree->getUsedNodes()) : 0;
+
+    int total = 0;
+    for (const auto &worker : workers)
+        total += worker->getNodesCreated();
+    return total;
+}
+
+int ParallelMCTS::getTranspositionHits() const
+{
+    int total = 0;
+    for (const auto &worker : workers)
+        total += worker->getTranspositionHits();
+    return total;
+}
+
+int ParallelMCTS::getReusedVisits() const
+{
+    int total = 0;
+    for (const auto &worker : workers)
+        total += worker->getReusedVisits();
+    return total;
+}
@@ -5,60 +5,106 @@
 #include <memory>
 #include <cmath>
 #include <limits>
-#include <random>
 #include <thread>
 #include <atomic>
 #include <array>
+#include <mutex>
+#include <stdexcept>
 #include "environment.hpp"
-
-constexpr int MAX_PLAYERS = 6;
+#include "batch_rollout.hpp"
+#include "mcts.hpp" // NodeType
+#include "transposition_table.hpp"
 
 class NodePool;
 
+// as MCTSNode, shared between parents when transpositions are on
 class ParallelMCTSNode
 {
 public:
     State state;
     MoveType moveFromParent;
-    ParallelMCTSNode *parent;
 
-    ParallelMCTSNode **children;
+    ParallelMCTSNode **children; // chance node: one slot per roll, minRoll first, null until reached
     int childCount;
     int childCapacity;
+    std::array<MoveType, MAX_MOVES> childMoves; // decision node: the move along each child's edge
 
     int visits;
     std::array<double, MAX_PLAYERS> wins;
     int numPlayers;
 
-    std::vector<MoveType> unexpandedMoves;
+    MoveMask unexpandedMoves;
     bool movedThisTurn;
 
     double logVisits;
 
+    NodeType nodeType;
+    int pendingRoll;
+    unsigned mark; // as in MCTSNode
+
     ParallelMCTSNode()
-        : state(1), parent(nullptr), children(nullptr), childCount(0), childCapacity(0),
-          visits(0), numPlayers(0), movedThisTurn(false), logVisits(0.0)
+        : state(1), children(nullptr), childCount(0), childCapacity(0),
+          visits(0), numPlayers(0), unexpandedMoves(0), movedThisTurn(false), logVisits(0.0),
+          nodeType(NodeType::DECISION), pendingRoll(0), mark(0)
     {
         wins.fill(0.0);
     }
 
-    void init(const State &s, ParallelMCTSNode *p, MoveType move, bool moved, int nPlayers)
+    void init(const State &s, MoveType move, bool moved, int nPlayers)
     {
         state = s;
         moveFromParent = move;
-        parent = p;
         childCount = 0;
         visits = 0;
         wins.fill(0.0);
         numPlayers = nPlayers;
         movedThisTurn = moved;
         logVisits = 0.0;
-        unexpandedMoves = state.getPossibleMoves(movedThisTurn);
+        unexpandedMoves = state.getPossibleMoves(movedThisTurn).mask();
+        nodeType = NodeType::DECISION;
+        pendingRoll = 0;
+        mark = 0;
+    }
+
+    // a chance node holds the state before the roll; `move` is the CONTINUE or RETURN to play.
+    // Its child block must have a slot for every roll.
+    void initChance(const State &s, MoveType move, int nPlayers)
+    {
+        init(s, move, false, nPlayers);
+        unexpandedMoves = 0;
+        nodeType = NodeType::CHANCE;
+        childCount = childCapacity;
+        std::fill(children, children + childCount, nullptr);
     }
 
     bool isFullyExpanded() const
     {
-        return unexpandedMoves.empty();
+        return nodeType == NodeType::CHANCE ? pendingRoll == 0 : unexpandedMoves == 0;
+    }
+
+    ParallelMCTSNode *childForRoll(int roll) const
+    {
+        return children[roll - state.getRules().minRoll()];
+    }
+
+    double value(int playerIndex) const
+    {
+        if (nodeType == NodeType::DECISION)
+            return wins[playerIndex] / visits;
+
+        const RulesConfig &rules = state.getRules();
+        double sum = 0;
+        double weight = 0;
+        for (int i = 0; i < childCount; i++)
+        {
+            const ParallelMCTSNode *child = children[i];
+            if (child == nullptr || child->visits == 0)
+                continue;
+            double probability = rules.rollProbability(rules.minRoll() + i);
+            sum += probability * child->wins[playerIndex] / child->visits;
+            weight += probability;
+        }
+        return weight > 0 ? sum / weight : wins[playerIndex] / visits;
     }
 
     bool isTerminal() const
@@ -71,7 +117,7 @@ public:
         if (visits == 0)
             return std::numeric_limits<double>::infinity();
 
-        double exploitation = wins[playerIndex] / visits;
+        double exploitation = value(playerIndex);
         double exploration = explorationConstant * std::sqrt(parentLogVisits / visits);
 
         return exploitation + exploration;
@@ -86,12 +132,22 @@ public:
 
 class NodePool
 {
+public:
+    static constexpr int CHILD_ARRAY_SIZE = 8; // enough for every move; chance nodes ask for their rolls
+
 private:
     std::vector<ParallelMCTSNode> nodes;
-    std::vector<ParallelMCTSNode *> childArrayPool;
+    std::vector<ParallelMCTSNode *> childArrayPool; // child blocks, handed out in node order
     size_t nextNode;
     size_t nextChildArray;
-    static constexpr int CHILD_ARRAY_SIZE = 8;
+
+    std::vector<uint32_t> kept;  // compact(): pool indices of the surviving subtree
+    std::vector<uint32_t> remap; // compact(): new index of every surviving node, by old index
+
+    uint32_t indexOf(const ParallelMCTSNode *node) const
+    {
+        return static_cast<uint32_t>(node - nodes.data());
+    }
 
 public:
     NodePool(size_t capacity = 1000000)
@@ -107,23 +163,36 @@ public:
         nextChildArray = 0;
     }
 
-    ParallelMCTSNode *allocateNode()
+    bool hasRoom(size_t nodeCount, size_t childSlots) const
     {
-        if (nextNode >= nodes.size())
-        {
-            nodes.resize(nodes.size() * 2);
-            childArrayPool.resize(childArrayPool.size() * 2);
-        }
+        return nextNode + nodeCount <= nodes.size() && nextChildArray + childSlots <= childArrayPool.size();
+    }
+
+    // callers make room first with grow(), which may move nodes, between iterations
+    ParallelMCTSNode *allocateNode(int childSlots = CHILD_ARRAY_SIZE)
+    {
+        if (!hasRoom(1, childSlots))
+            throw std::runtime_error("Node pool is full");
         ParallelMCTSNode *node = &nodes[nextNode++];
 
         node->children = &childArrayPool[nextChildArray];
-        node->childCapacity = CHILD_ARRAY_SIZE;
-        nextChildArray += CHILD_ARRAY_SIZE;
+        node->childCapacity = childSlots;
+        nextChildArray += childSlots;
 
         return node;
     }
 
+    // Moves the subtree under root to the front of the pool, in allocation order, and frees
+    // every other node; returns root's new address. Pointers into the pool are invalidated.
+    ParallelMCTSNode *compact(ParallelMCTSNode *root);
+
+    // Doubles the pool, moving every node; returns root's new address. Pointers into the
+    // pool are invalidated.
+    ParallelMCTSNode *grow(ParallelMCTSNode *root);
+
     size_t getUsedNodes() const { return nextNode; }
+
+    ParallelMCTSNode &operator[](size_t index) { return nodes[index]; } // in allocation order
 };
 
 struct MoveStats
@@ -138,33 +207,305 @@ struct MoveStats
 
 class MCTSWorker
 {
+public:
+    // An iteration adds at most two nodes. Pools start no larger than this and double when a
+    // search outgrows them, so the iteration cap of a timed search never decides the allocation.
+    static constexpr size_t INITIAL_POOL_NODES = 1 << 12;
+
 private:
     int numPlayers;
     int iterations;
     double explorationConstant;
-    std::mt19937 rng;
+    ValuationPolicy valuation;
+    int rolloutsPerLeaf;
+    RNG rng;
     NodePool pool;
+    BatchRollout simulator{RolloutPolicy::CAUTIOUS};
+    std::vector<ScoreVector> scores;
+
+    // the last search tree, re-rooted onto the position the game actually reached
+    ParallelMCTSNode *root = nullptr;
+    int reusedVisits = 0;
 
-    std::uniform_int_distribution<size_t> dist;
+    TranspositionTable<ParallelMCTSNode> transpositions; // as in MCTS
+    std::vector<ParallelMCTSNode *> path;
+    unsigned walk = 0;
+
+    int nodesCreated = 0;
+    int transpositionHits = 0;
+    int lastIterations = 0;
 
 public:
-    MCTSWorker(int numPlayers, int iterations, double explorationConstant, unsigned int seed)
+    MCTSWorker(int numPlayers, int iterations, double explorationConstant, ValuationPolicy valuation,
+               const RNG &stream, int rolloutsPerLeaf = 1)
         : numPlayers(numPlayers), iterations(iterations),
-          explorationConstant(explorationConstant), rng(seed),
-          pool(std::max(100000, iterations / 10))
+          explorationConstant(explorationConstant), valuation(valuation),
+          rolloutsPerLeaf(std::max(1, rolloutsPerLeaf)), rng(stream),
+          pool(std::min(2 * static_cast<size_t>(std::max(1, iterations)), INITIAL_POOL_NODES))
+    {
+    }
+
+    // as MCTS::findBestMove, visits kept from the previous search count towards the iterations;
+    // a timed deadline ends it early in the same way
+    std::vector<MoveStats> search(const State &state, int playerIndex, bool movedThisTurn,
+                                  const SearchDeadline &deadline = SearchDeadline());
+
+    int getLastIterations() const
+    {
+        return lastIterations;
+    }
+
+    int getReusedVisits() const
+    {
+        return reusedVisits;
+    }
+
+    size_t getUsedNodes() const
     {
+        return pool.getUsedNodes();
     }
 
-    std::vector<MoveStats> search(const State &state, int playerIndex, bool movedThisTurn);
+    // as in MCTS
+    void setTranspositions(size_t entries)
+    {
+        transpositions.resize(entries);
+        root = nullptr;
+    }
+
+    int getNodesCreated() const
+    {
+        return nodesCreated;
+    }
+
+    int getTranspositionHits() const
+    {
+        return transpositionHits;
+    }
 
 private:
+    void iterate();
+    bool isDecided(long remaining) const;
+    void indexPool();
+    void reroot(const State &state, bool movedThisTurn);
+    ParallelMCTSNode *findNode(ParallelMCTSNode *node, const State &state, uint64_t hash, bool movedThisTurn);
     ParallelMCTSNode *select(ParallelMCTSNode *node);
     ParallelMCTSNode *expand(ParallelMCTSNode *node);
+    ParallelMCTSNode *expandRoll(ParallelMCTSNode *chance);
     std::array<double, MAX_PLAYERS> simulate(ParallelMCTSNode *node);
-    void backpropagate(ParallelMCTSNode *node, const std::array<double, MAX_PLAYERS> &rewards);
+    ParallelMCTSNode *newChild(const State &state, MoveType move, bool movedThisTurn);
+    void backpropagate(const std::array<double, MAX_PLAYERS> &rewards);
     ParallelMCTSNode *selectBestChild(ParallelMCTSNode *node);
-    std::array<double, MAX_PLAYERS> getRewards(const State &terminalState);
-    MoveType getRandomMove(const std::vector<MoveType> &moves);
+    void addRewards(const ScoreVector &finalScores, std::array<double, MAX_PLAYERS> &rewards);
+};
+
+// How ParallelMCTS spreads a search over its threads
+enum class ParallelMode
+{
+    ROOT, // every thread grows its own tree; the root moves' statistics are summed
+    TREE  // all threads descend one shared tree, kept apart by virtual loss
+};
+
+// A node of the shared tree. Statistics are atomic and nothing takes a lock: a thread claims an
+// untried move by clearing its bit, and a child is published with a CAS on its slot once it is
+// fully built, so readers only see finished nodes.
+class SharedTreeNode
+{
+public:
+    static constexpr int MOVE_SLOTS = END + 1; // a decision node's children sit at their move's index
+
+    State state; // its RNG pointer is cleared: threads bring their own
+    MoveType moveFromParent;
+    bool movedThisTurn;
+    NodeType nodeType;
+
+    std::atomic<int> visits;
+    std::atomic<int> virtualLoss; // threads below this node whose backup is still to come
+    std::array<std::atomic<double>, MAX_PLAYERS> wins;
+
+    std::atomic<MoveMask> unexpandedMoves;   // a set bit is a move no thread has claimed yet
+    std::atomic<SharedTreeNode *> *children; // decision: one slot per move; chance: one per roll
+    int slotCount;
+
+    SharedTreeNode()
+        : state(1), moveFromParent(LEAVE_TREASURE), movedThisTurn(false), nodeType(NodeType::DECISION),
+          visits(0), virtualLoss(0), unexpandedMoves(0), children(nullptr), slotCount(0)
+    {
+        for (auto &w : wins)
+            w.store(0.0, std::memory_order_relaxed);
+    }
+
+    static int slotsFor(const RulesConfig &rules, NodeType type)
+    {
+        return type == NodeType::CHANCE ? rules.maxRoll() - rules.minRoll() + 1 : MOVE_SLOTS;
+    }
+
+    // only before the node is published
+    void init(const State &s, MoveType move, bool moved, NodeType type, std::atomic<SharedTreeNode *> *slots)
+    {
+        state = s;
+        state.setRng(nullptr);
+        moveFromParent = move;
+        movedThisTurn = moved;
+        nodeType = type;
+        visits.store(0, std::memory_order_relaxed);
+        virtualLoss.store(0, std::memory_order_relaxed);
+        for (auto &w : wins)
+            w.store(0.0, std::memory_order_relaxed);
+
+        children = slots;
+        slotCount = slotsFor(state.getRules(), type);
+        for (int i = 0; i < slotCount; i++)
+            children[i].store(nullptr, std::memory_order_relaxed);
+        unexpandedMoves.store(type == NodeType::CHANCE ? 0 : state.getPossibleMoves(moved).mask(),
+                              std::memory_order_relaxed);
+    }
+
+    SharedTreeNode *child(int slot) const
+    {
+        return children[slot].load(std::memory_order_acquire);
+    }
+
+    std::atomic<SharedTreeNode *> &slotForRoll(int roll) const
+    {
+        return children[roll - state.getRules().minRoll()];
+    }
+
+    bool isTerminal() const
+    {
+        return state.isTerminal() && state.isLastRound();
+    }
+
+    // as ParallelMCTSNode::value; the caller scales it down for virtual losses
+    double value(int playerIndex) const
+    {
+        int n = visits.load(std::memory_order_relaxed);
+        if (nodeType == NodeType::DECISION)
+            return n > 0 ? wins[playerIndex].load(std::memory_order_relaxed) / n : 0.0;
+
+        const RulesConfig &rules = state.getRules();
+        double sum = 0;
+        double weight = 0;
+        for (int i = 0; i < slotCount; i++)
+        {
+            const SharedTreeNode *outcome = child(i);
+            int childVisits = outcome ? outcome->visits.load(std::memory_order_relaxed) : 0;
+            if (childVisits == 0)
+                continue;
+            double probability = rules.rollProbability(rules.minRoll() + i);
+            sum += probability * outcome->wins[playerIndex].load(std::memory_order_relaxed) / childVisits;
+            weight += probability;
+        }
+        if (weight > 0)
+            return sum / weight;
+        return n > 0 ? wins[playerIndex].load(std::memory_order_relaxed) / n : 0.0;
+    }
+};
+
+// Stable addresses for shared nodes and their child slots. Threads carve nodes out of chunks
+// they take for themselves, so the mutex is only held to hand out a chunk; chunks never move,
+// and reset() keeps them for the next search.
+class SharedNodeArena
+{
+public:
+    static constexpr size_t CHUNK_NODES = 256;
+    static constexpr size_t CHUNK_SLOTS = CHUNK_NODES * NodePool::CHILD_ARRAY_SIZE;
+
+    // one thread's place in its current chunks
+    struct Cursor
+    {
+        SharedTreeNode *node = nullptr;
+        SharedTreeNode *nodeEnd = nullptr;
+        std::atomic<SharedTreeNode *> *slot = nullptr;
+        std::atomic<SharedTreeNode *> *slotEnd = nullptr;
+        SharedTreeNode *spare = nullptr; // a decision node that lost the race for its slot
+    };
+
+private:
+    std::vector<std::unique_ptr<SharedTreeNode[]>> nodeChunks;
+    std::vector<std::unique_ptr<std::atomic<SharedTreeNode *>[]>> slotChunks;
+    size_t nodeChunksTaken = 0;
+    size_t slotChunksTaken = 0;
+    std::atomic<size_t> used{0};
+    std::mutex mutex;
+
+public:
+    // a node and `childSlots` contiguous child slots, both uninitialised
+    std::pair<SharedTreeNode *, std::atomic<SharedTreeNode *> *> allocate(Cursor &cursor, int childSlots);
+
+    // hands back a decision node that was never published; its thread reuses it next
+    void recycle(Cursor &cursor, SharedTreeNode *node);
+
+    void reset();
+
+    size_t getUsedNodes() const { return used.load(); }
+};
+
+// The shared-tree search behind ParallelMode::TREE. Each search starts a fresh tree.
+class SharedTreeSearch
+{
+private:
+    int numPlayers;
+    int iterations;
+    int numThreads;
+    double explorationConstant;
+    ValuationPolicy valuation;
+    int rolloutsPerLeaf;
+    RNG rng; // split into one stream per thread and search
+
+    SharedNodeArena arena;
+    SharedTreeNode *root = nullptr;
+    std::atomic<int> claimed{0};   // iterations handed out
+    std::atomic<int> completed{0}; // and backed up
+    std::atomic<bool> stopped{false};
+
+    // what one thread keeps for itself
+    struct Context
+    {
+        RNG rng;
+        BatchRollout simulator{RolloutPolicy::CAUTIOUS};
+        std::vector<ScoreVector> scores;
+        std::vector<SharedTreeNode *> path;
+        State scratch{1};
+        SharedNodeArena::Cursor cursor;
+    };
+
+public:
+    SharedTreeSearch(int numPlayers, int iterations, int numThreads, double explorationConstant,
+                     ValuationPolicy valuation, const RNG &stream, int rolloutsPerLeaf = 1)
+        : numPlayers(numPlayers), iterations(iterations), numThreads(std::max(1, numThreads)),
+          explorationConstant(explorationConstant), valuation(valuation),
+          rolloutsPerLeaf(std::max(1, rolloutsPerLeaf)), rng(stream)
+    {
+    }
+
+    // root move statistics after `iterations` iterations over all threads, or at the deadline
+    std::vector<MoveStats> search(const State &state, int playerIndex, bool movedThisTurn,
+                                  const SearchDeadline &deadline = SearchDeadline());
+
+    int getLastIterations() const
+    {
+        return completed.load();
+    }
+
+    size_t getUsedNodes() const
+    {
+        return arena.getUsedNodes();
+    }
+
+    const SharedTreeNode *getRoot() const // the last search tree, for inspection
+    {
+        return root;
+    }
+
+private:
+    void run(Context &ctx, const SearchDeadline &deadline);
+    void iterate(Context &ctx);
+    SharedTreeNode *newNode(const State &state, MoveType move, bool movedThisTurn, NodeType type, Context &ctx);
+    SharedTreeNode *publish(std::atomic<SharedTreeNode *> &slot, SharedTreeNode *child, Context &ctx, bool &created);
+    SharedTreeNode *expand(SharedTreeNode *node, Context &ctx);
+    SharedTreeNode *expandRoll(SharedTreeNode *chance, int roll, Context &ctx, bool &created);
+    SharedTreeNode *selectBestChild(SharedTreeNode *node) const;
+    bool isDecided(long remaining) const;
 };
 
 class ParallelMCTS
@@ -174,11 +515,22 @@ private:
     int iterationsPerThread;
     int numThreads;
     double explorationConstant;
+    ValuationPolicy valuation;
+    int rolloutsPerLeaf = 1;
+    size_t transpositionEntries = 0; // per worker
+    ParallelMode mode = ParallelMode::ROOT;
+    RNG rng; // split into one stream per worker
+
+    // created by the first search and kept, trees included, for the ones after it
+    std::vector<std::unique_ptr<MCTSWorker>> workers;
+    std::unique_ptr<SharedTreeSearch> sharedTree; // ParallelMode::TREE
 
 public:
     ParallelMCTS(int numPlayers, int totalIterations = 10000000,
-                 double explorationConstant = 1.41, int numThreads = 0)
-        : numPlayers(numPlayers), explorationConstant(explorationConstant)
+                 double explorationConstant = 1.41, int numThreads = 0,
+                 ValuationPolicy valuation = ValuationPolicy::MIDPOINT)
+        : numPlayers(numPlayers), explorationConstant(explorationConstant), valuation(valuation),
+          rng(RNG::local().split())
     {
         if (numThreads <= 0)
             this->numThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
@@ -188,9 +540,59 @@ public:
         this->iterationsPerThread = totalIterations / this->numThreads;
     }
 
+    void setRng(const RNG &stream)
+    {
+        rng = stream;
+        workers.clear();
+        sharedTree.reset();
+    }
+
+    // rollouts played from every expanded leaf; their rewards are averaged into one backup
+    void setRolloutsPerLeaf(int rollouts)
+    {
+        rolloutsPerLeaf = std::max(1, rollouts);
+        workers.clear();
+        sharedTree.reset();
+    }
+
+    // a transposition table of `entries` slots in every worker; 0 keeps plain trees.
+    // Root parallelism only.
+    void setTranspositions(size_t entries)
+    {
+        transpositionEntries = entries;
+        workers.clear();
+    }
+
+    // the same iterations either way: numThreads times the per-thread share
+    void setMode(ParallelMode parallelMode)
+    {
+        mode = parallelMode;
+        workers.clear();
+        sharedTree.reset();
+    }
+
+    ParallelMode getMode() const { return mode; }
+
     MoveType findBestMove(const State &state, int playerIndex, bool movedThisTurn);
 
+    // as MCTS: every worker searches until the deadline, or until its own leading move is safe
+    MoveType findBestMove(const State &state, int playerIndex, bool movedThisTurn, std::chrono::milliseconds budget);
+
+    // iterations all workers ran in the last findBestMove
+    int getLastIterations() const;
+
+    // nodes allocated and transpositions found by all workers in the last findBestMove
+    int getNodesCreated() const;
+    int getTranspositionHits() const;
+
+    // root visits all workers carried over from earlier searches in the last findBestMove
+    int getReusedVisits() const;
+
     int getNumThreads() const { return numThreads; }
+
+private:
+    void prepare(); // builds the workers or the shared tree, before any clock starts
+    MoveType search(const State &state, int playerIndex, bool movedThisTurn, const SearchDeadline &deadline);
 };
 
 #endif // PARALLEL_MCTS_HPP
@@ -1,135 +1,120 @@
 #include "pure_mcts.hpp"
 #include <algorithm>
+#include <array>
+#include <functional>
 #include <limits>
 
-double PureMCTS::rollout(State &state, bool movedThisTurn, int playerIndex)
+// the first seat with the highest score
+int PureMCTS::winner(const ScoreVector &score) const
 {
-    int maxSteps = 10000;
-    int steps = 0;
+    double bestScore = -1;
+    int winnerIndex = 0;
 
-    while (!(state.isTerminal() && state.isLastRound()) && steps < maxSteps)
+    for (int i = 0; i < numPlayers; i++)
     {
-        std::vector<MoveType> moves = state.getPossibleMoves(movedThisTurn);
-
-        if (moves.empty())
+        if (score[i] > bestScore)
         {
-            break;
+            bestScore = score[i];
+            winnerIndex = i;
         }
+    }
 
-        if (moves[0] == END)
-        {
-            state = state.doMove(END);
-            movedThisTurn = false;
-            steps++;
-            continue;
-        }
+    return winnerIndex;
+}
 
-        std::uniform_int_distribution<size_t> dist(0, moves.size() - 1);
-        MoveType randomMove = moves[dist(rng)];
+int PureMCTS::countWins(int rollouts, int playerIndex) const
+{
+    int wins = 0;
+    for (int i = 0; i < rollouts; i++)
+        if (winner(scores[i]) == playerIndex)
+            wins++;
+    return wins;
+}
 
-        state = state.doMove(randomMove);
+MoveType PureMCTS::findBestMove(const State &state, int playerIndex, bool movedThisTurn)
+{
+    lastRollouts = 0;
+    MoveList moves = state.getPossibleMoves(movedThisTurn);
 
-        if (randomMove == CONTINUE || randomMove == RETURN)
-        {
-            movedThisTurn = true;
-        }
-        else
-        {
-            movedThisTurn = false;
-        }
+    if (moves.empty())
+        return LEAVE_TREASURE;
 
-        steps++;
-    }
+    if (moves.size() == 1)
+        return moves[0];
 
-    const auto &players = state.getPlayers();
-    int bestScore = -1;
-    int winnerIndex = 0;
+    State rootState = state;
+    rootState.setValuationPolicy(valuation); // simulated round ends never touch the real value pools
 
-    for (int i = 0; i < numPlayers; i++)
+    size_t bestMoveIndex = 0;
+    double bestWinRate = -1.0;
+    scores.resize(rolloutsPerMove);
+
+    for (size_t i = 0; i < moves.size(); i++)
     {
-        int score = players[i].getPoints();
-        if (score > bestScore)
+        RNG moveRng = rng.split(); // one stream per move, as the timed search draws them
+        simulator.runAfter(rootState, movedThisTurn, moves[i], rolloutsPerMove, moveRng, scores.data());
+
+        double winRate = static_cast<double>(countWins(rolloutsPerMove, playerIndex)) / rolloutsPerMove;
+        if (winRate > bestWinRate)
         {
-            bestScore = score;
-            winnerIndex = i;
+            bestWinRate = winRate;
+            bestMoveIndex = i;
         }
     }
 
-    return (winnerIndex == playerIndex) ? 1.0 : 0.0;
+    lastRollouts = rolloutsPerMove;
+    return moves[bestMoveIndex];
 }
 
-MoveType PureMCTS::findBestMove(const State &state, int playerIndex, bool movedThisTurn)
+MoveType PureMCTS::findBestMove(const State &state, int playerIndex, bool movedThisTurn,
+                                std::chrono::milliseconds budget)
 {
-    Tile::useDeterministicValues = true;
-
-    std::vector<MoveType> moves = state.getPossibleMoves(movedThisTurn);
+    SearchDeadline deadline(budget);
+    lastRollouts = 0;
+    MoveList moves = state.getPossibleMoves(movedThisTurn);
 
     if (moves.empty())
-    {
-        Tile::useDeterministicValues = false;
         return LEAVE_TREASURE;
-    }
 
     if (moves.size() == 1)
-    {
-        Tile::useDeterministicValues = false;
         return moves[0];
-    }
 
-    size_t bestMoveIndex = 0;
-    double bestWinRate = -1.0;
+    State rootState = state;
+    rootState.setValuationPolicy(valuation);
 
+    // Every move gets the same rollouts, so comparing wins compares win rates. Each move draws
+    // from its own stream, so its rollouts are those of the fixed-count search however the
+    // rounds interleave them, and a search the deadline does not cut short picks the same move.
+    std::array<int, MAX_MOVES> wins{};
+    std::array<RNG, MAX_MOVES> moveRngs;
     for (size_t i = 0; i < moves.size(); i++)
-    {
-        MoveType move = moves[i];
-        double totalWins = 0.0;
+        moveRngs[i] = rng.split();
+    int played = 0;
+    scores.resize(SearchDeadline::CHECK_INTERVAL);
 
-        bool nextMovedThisTurn;
-        if (move == CONTINUE || move == RETURN)
-        {
-            nextMovedThisTurn = true;
-        }
-        else
+    while (played < rolloutsPerMove)
+    {
+        int batch = std::min(SearchDeadline::CHECK_INTERVAL, rolloutsPerMove - played);
+        for (size_t i = 0; i < moves.size(); i++)
         {
-            nextMovedThisTurn = false;
+            simulator.runAfter(rootState, movedThisTurn, moves[i], batch, moveRngs[i], scores.data());
+            wins[i] += countWins(batch, playerIndex);
         }
+        played += batch;
 
-        for (int r = 0; r < rolloutsPerMove; r++)
-        {
-            State nextState = state.doMove(move);
-
-            if (nextState.isTerminal() && nextState.isLastRound())
-            {
-                const auto &players = nextState.getPlayers();
-                int bestScore = -1;
-                int winnerIndex = 0;
-                for (int p = 0; p < numPlayers; p++)
-                {
-                    if (players[p].getPoints() > bestScore)
-                    {
-                        bestScore = players[p].getPoints();
-                        winnerIndex = p;
-                    }
-                }
-                if (winnerIndex == playerIndex)
-                {
-                    totalWins += 1.0;
-                }
-            }
-            else
-            {
-                totalWins += rollout(nextState, nextMovedThisTurn, playerIndex);
-            }
-        }
+        long remaining = std::min<long>(rolloutsPerMove - played,
+                                        deadline.remainingIterations(long(played) * moves.size()) / moves.size());
+        std::array<int, MAX_MOVES> ranked = wins;
+        std::sort(ranked.begin(), ranked.begin() + moves.size(), std::greater<int>());
+        if (remaining == 0 || SearchDeadline::isDecided(ranked[0], ranked[1], remaining))
+            break;
+    }
+    lastRollouts = played;
 
-        double winRate = totalWins / rolloutsPerMove;
-        if (winRate > bestWinRate)
-        {
-            bestWinRate = winRate;
+    size_t bestMoveIndex = 0;
+    for (size_t i = 1; i < moves.size(); i++)
+        if (wins[i] > wins[bestMoveIndex])
             bestMoveIndex = i;
-        }
-    }
 
-    Tile::useDeterministicValues = false;
     return moves[bestMoveIndex];
 }
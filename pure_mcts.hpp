@@ -2,27 +2,48 @@
 #define PURE_MCTS_HPP
 
 #include "environment.hpp"
+#include "batch_rollout.hpp"
+#include "search_deadline.hpp"
 #include <vector>
-#include <random>
 
 class PureMCTS
 {
 private:
     int numPlayers;
     int rolloutsPerMove;
-    std::mt19937 rng;
+    ValuationPolicy valuation;
+    RNG rng;
+    BatchRollout simulator;
+    std::vector<ScoreVector> scores;
+    int lastRollouts = 0;
 
-    double rollout(State &state, bool movedThisTurn, int playerIndex);
+    int winner(const ScoreVector &score) const;
+    int countWins(int rollouts, int playerIndex) const;
 
 public:
-    PureMCTS(int numPlayers, int rolloutsPerMove = 1000)
-        : numPlayers(numPlayers), rolloutsPerMove(rolloutsPerMove)
+    PureMCTS(int numPlayers, int rolloutsPerMove = 1000,
+             ValuationPolicy valuation = ValuationPolicy::MIDPOINT)
+        : numPlayers(numPlayers), rolloutsPerMove(rolloutsPerMove), valuation(valuation),
+          rng(RNG::local().split())
     {
-        std::random_device rd;
-        rng = std::mt19937(rd());
+    }
+
+    void setRng(const RNG &stream)
+    {
+        rng = stream;
     }
 
     MoveType findBestMove(const State &state, int playerIndex, bool movedThisTurn);
+
+    // Plays the moves' rollouts in rounds until `budget` has passed (`rolloutsPerMove` still caps
+    // them), or until the leader's wins can no longer be caught in the time left.
+    MoveType findBestMove(const State &state, int playerIndex, bool movedThisTurn, std::chrono::milliseconds budget);
+
+    // rollouts per move played by the last findBestMove
+    int getLastRollouts() const
+    {
+        return lastRollouts;
+    }
 };
 
 #endif // PURE_MCTS_HPP
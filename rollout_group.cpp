@@ -0,0 +1,97 @@
+#include "rollout_group.hpp"
+#include <algorithm>
+
+RolloutGroup::RolloutGroup(int workers, RolloutPolicy policy)
+{
+    workers = std::max(1, workers);
+    for (int w = 0; w < workers; w++)
+        simulators.push_back(std::make_unique<BatchRollout>(policy));
+    shares.resize(workers);
+
+    for (int w = 1; w < workers; w++)
+        threads.emplace_back([this, w]()
+                             { work(w); });
+}
+
+RolloutGroup::~RolloutGroup()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+void RolloutGroup::run(const State &state, bool movedThisTurn, int count, RNG &rng, ScoreVector *scores)
+{
+    int workers = getWorkers();
+    int first = 0;
+    for (int w = 0; w < workers; w++)
+    {
+        Share &share = shares[w];
+        share.rng = rng;
+        share.first = first;
+        share.count = count / workers + (w < count % workers ? 1 : 0);
+        for (int i = 0; i < share.count; i++)
+            rng.next(); // rollout i seeds itself with the stream's i-th draw
+        first += share.count;
+    }
+
+    this->state = &state;
+    this->movedThisTurn = movedThisTurn;
+    this->scores = scores;
+
+    if (workers == 1 || shares[1].count == 0) // too few rollouts to share
+    {
+        shares[0].count = count;
+        play(0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        job++;
+        pending = workers - 1;
+    }
+    wake.notify_all();
+
+    play(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this]()
+                  { return pending == 0; });
+}
+
+void RolloutGroup::work(int worker)
+{
+    unsigned served = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this, served]()
+                      { return stopping || job != served; });
+            if (stopping)
+                return;
+            served = job;
+        }
+
+        play(worker);
+
+        bool last;
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            last = --pending == 0;
+        }
+        if (last)
+            finished.notify_one();
+    }
+}
+
+void RolloutGroup::play(int worker)
+{
+    Share &share = shares[worker];
+    simulators[worker]->run(*state, movedThisTurn, share.count, share.rng, scores + share.first);
+}
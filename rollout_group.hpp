@@ -0,0 +1,64 @@
+#ifndef ROLLOUT_GROUP_HPP
+#define ROLLOUT_GROUP_HPP
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "batch_rollout.hpp"
+
+/**
+ * A fixed group of threads that share out the rollouts of one position, each through its own
+ * BatchRollout. The calling thread plays the first share, so a group of one runs inline.
+ *
+ * Worker w starts from a copy of the caller's stream advanced past the rollouts before its
+ * share, and the caller's stream ends up past all of them. Since rollout i draws only its
+ * own seed, the scores are those of a single BatchRollout::run whatever the group size.
+ */
+class RolloutGroup
+{
+public:
+    explicit RolloutGroup(int workers, RolloutPolicy policy = RolloutPolicy::UNIFORM);
+    ~RolloutGroup();
+
+    RolloutGroup(const RolloutGroup &) = delete;
+    RolloutGroup &operator=(const RolloutGroup &) = delete;
+
+    // as BatchRollout::run: scores[i] receives the final points of rollout i
+    void run(const State &state, bool movedThisTurn, int count, RNG &rng, ScoreVector *scores);
+
+    int getWorkers() const
+    {
+        return static_cast<int>(simulators.size());
+    }
+
+private:
+    struct Share
+    {
+        RNG rng;
+        int first = 0;
+        int count = 0;
+    };
+
+    std::vector<std::unique_ptr<BatchRollout>> simulators; // [0] is the caller's
+    std::vector<Share> shares;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable wake;     // a new job, or shutdown
+    std::condition_variable finished; // the last share of a job is done
+    unsigned job = 0;
+    int pending = 0;
+    bool stopping = false;
+
+    // the job being served
+    const State *state = nullptr;
+    bool movedThisTurn = false;
+    ScoreVector *scores = nullptr;
+
+    void work(int worker);
+    void play(int worker);
+};
+
+#endif // ROLLOUT_GROUP_HPP
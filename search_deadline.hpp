@@ -0,0 +1,59 @@
+#ifndef SEARCH_DEADLINE_HPP
+#define SEARCH_DEADLINE_HPP
+
+#include <chrono>
+#include <limits>
+
+/**
+ * End of a time-budgeted search. Searches read the clock once per batch of CHECK_INTERVAL
+ * iterations and, from their rate so far, estimate how many more still fit in the budget.
+ */
+class SearchDeadline
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr int CHECK_INTERVAL = 32;
+
+private:
+    bool timed = false;
+    Clock::time_point start;
+    Clock::time_point end;
+
+public:
+    SearchDeadline() = default; // no deadline: searches run their full iteration count
+
+    explicit SearchDeadline(std::chrono::milliseconds budget)
+        : timed(true), start(Clock::now()), end(start + budget)
+    {
+    }
+
+    bool isTimed() const
+    {
+        return timed;
+    }
+
+    // iterations that fit before the deadline at the rate of the `done` so far; 0 once it has passed
+    long remainingIterations(long done) const
+    {
+        if (!timed)
+            return std::numeric_limits<long>::max();
+
+        Clock::time_point now = Clock::now();
+        if (now >= end)
+            return 0;
+
+        double elapsed = std::chrono::duration<double>(now - start).count();
+        double left = std::chrono::duration<double>(end - now).count();
+        if (done == 0 || elapsed <= 0)
+            return std::numeric_limits<long>::max();
+        return static_cast<long>(done / elapsed * left) + 1;
+    }
+
+    // the leader stays ahead even if all of the remaining count goes to the runner-up
+    static bool isDecided(long best, long second, long remaining)
+    {
+        return best - second > remaining;
+    }
+};
+
+#endif // SEARCH_DEADLINE_HPP
@@ -0,0 +1,253 @@
+#include "state_codec.hpp"
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    class BitWriter
+    {
+    private:
+        EncodedState &out;
+        uint64_t buffer = 0;
+        int bits = 0;
+
+    public:
+        explicit BitWriter(EncodedState &out)
+            : out(out)
+        {
+        }
+
+        void write(uint64_t value, int width) // width <= 32
+        {
+            buffer |= value << bits;
+            bits += width;
+            while (bits >= 8)
+            {
+                out.push_back(static_cast<uint8_t>(buffer));
+                buffer >>= 8;
+                bits -= 8;
+            }
+        }
+
+        void flush()
+        {
+            if (bits > 0)
+                out.push_back(static_cast<uint8_t>(buffer));
+            buffer = 0;
+            bits = 0;
+        }
+    };
+
+    class BitReader
+    {
+    private:
+        const uint8_t *data;
+        const uint8_t *end;
+        uint64_t buffer = 0;
+        int bits = 0;
+
+    public:
+        BitReader(const uint8_t *data, size_t size)
+            : data(data), end(data + size)
+        {
+        }
+
+        uint32_t read(int width) // width <= 32
+        {
+            while (bits < width)
+            {
+                if (data == end)
+                    throw std::runtime_error("Encoded state is truncated");
+                buffer |= uint64_t(*data++) << bits;
+                bits += 8;
+            }
+
+            uint32_t value = static_cast<uint32_t>(buffer & ((uint64_t(1) << width) - 1));
+            buffer >>= width;
+            bits -= width;
+            return value;
+        }
+
+        uint32_t read(int width, uint32_t max, const char *field)
+        {
+            uint32_t value = read(width);
+            if (value > max)
+                throw std::runtime_error(std::string("Encoded state has an invalid ") + field);
+            return value;
+        }
+    };
+
+    constexpr uint32_t SHORT_POINTS = 1024; // whole scores below this take 10 bits
+
+    // Field widths that grew when the rules became configurable; version 1 states are
+    // always standard games
+    struct FieldWidths
+    {
+        int round;
+        int oxygen;
+        int tiles;
+        int copies;
+    };
+
+    constexpr FieldWidths VERSION_1_WIDTHS = {2, 5, 6, 2};
+    constexpr FieldWidths VERSION_2_WIDTHS = {3, 7, 7, 3};
+
+    void writeStack(BitWriter &out, const TreasureStack &stack)
+    {
+        out.write(stack.size(), 2);
+        for (uint8_t level : stack)
+            out.write(level, 2);
+    }
+
+    void readStack(BitReader &in, TreasureStack &stack)
+    {
+        uint32_t size = in.read(2, MAX_STACK_CHIPS, "stack size");
+        stack.clear();
+        for (uint32_t i = 0; i < size; i++)
+            stack.push_back(static_cast<uint8_t>(in.read(2)));
+    }
+
+    void writePoints(BitWriter &out, double points)
+    {
+        if (points >= 0 && points < SHORT_POINTS && points == std::floor(points))
+        {
+            out.write(1, 1);
+            out.write(static_cast<uint32_t>(points), 10);
+            return;
+        }
+
+        uint64_t raw;
+        std::memcpy(&raw, &points, sizeof raw);
+        out.write(0, 1);
+        out.write(raw & 0xFFFFFFFFu, 32);
+        out.write(raw >> 32, 32);
+    }
+
+    double readPoints(BitReader &in)
+    {
+        if (in.read(1))
+            return in.read(10);
+
+        uint64_t raw = in.read(32);
+        raw |= uint64_t(in.read(32)) << 32;
+        double points;
+        std::memcpy(&points, &raw, sizeof points);
+        return points;
+    }
+}
+
+EncodedState StateCodec::encode(const State &state)
+{
+    EncodedState encoded;
+    BitWriter out(encoded);
+
+    const FieldWidths &widths = VERSION_2_WIDTHS;
+    const RulesConfig &rules = state.rules;
+    out.write(STATE_FORMAT_VERSION, 8);
+    out.write(rules.boardTiles, 7);
+    out.write(rules.oxygen, 7);
+    out.write(rules.rounds, 4);
+    out.write(rules.diceCount, 3);
+    out.write(rules.diceSides, 3);
+    out.write(state.players.size(), 3);
+    out.write(state.currentPlayer, 3);
+    out.write(state.lastPlayer, 3);
+    out.write(state.currentRound, widths.round);
+    out.write(state.oxygen, widths.oxygen);
+    out.write(static_cast<uint32_t>(state.valuation), 2);
+
+    const TileList &tiles = state.board.tiles;
+    out.write(tiles.size(), widths.tiles);
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        out.write(tiles[i].level, 3);
+        out.write(state.board.isFlippedAt(static_cast<int>(i) + 1), 1);
+        writeStack(out, tiles[i].treasure);
+    }
+
+    for (const Player &player : state.players)
+    {
+        out.write(player.position, widths.tiles);
+        out.write(player.isDead, 1);
+        out.write(player.isReturning, 1);
+        writePoints(out, player.points);
+        out.write(player.inventory.size(), 4);
+        for (const TreasureStack &stack : player.inventory)
+            writeStack(out, stack);
+    }
+
+    for (const auto &level : state.valuePools.counts)
+        for (uint8_t copies : level)
+            out.write(copies, widths.copies);
+
+    out.flush();
+    return encoded;
+}
+
+void StateCodec::decode(const uint8_t *data, size_t size, State &state)
+{
+    BitReader in(data, size);
+
+    uint32_t version = in.read(8);
+    if (version != 1 && version != STATE_FORMAT_VERSION)
+        throw std::runtime_error("Unsupported state format version " + std::to_string(version));
+
+    const FieldWidths &widths = version == 1 ? VERSION_1_WIDTHS : VERSION_2_WIDTHS;
+    RulesConfig &rules = state.rules;
+    rules = RulesConfig();
+    if (version >= 2)
+    {
+        rules.boardTiles = static_cast<int>(in.read(7));
+        rules.oxygen = static_cast<int>(in.read(7));
+        rules.rounds = static_cast<int>(in.read(4));
+        rules.diceCount = static_cast<int>(in.read(3));
+        rules.diceSides = static_cast<int>(in.read(3));
+        rules.validate();
+    }
+
+    uint32_t numPlayers = in.read(3, MAX_PLAYERS, "player count");
+    if (numPlayers == 0)
+        throw std::runtime_error("Encoded state has no players");
+
+    state.players.resize(numPlayers);
+    state.currentPlayer = static_cast<int>(in.read(3, numPlayers - 1, "current player"));
+    state.lastPlayer = static_cast<int>(in.read(3, numPlayers - 1, "last player"));
+    state.currentRound = static_cast<int>(in.read(widths.round, rules.rounds - 1, "round"));
+    state.oxygen = static_cast<int>(in.read(widths.oxygen, rules.oxygen, "oxygen"));
+    state.valuation = static_cast<ValuationPolicy>(in.read(2, 2, "valuation policy"));
+
+    Board &board = state.board;
+    uint32_t tileCount = in.read(widths.tiles, rules.boardTiles, "tile count");
+    board.tiles.resize(tileCount);
+    board.flippedMask = 0;
+    board.occupiedMask = 0;
+    for (uint32_t i = 0; i < tileCount; i++)
+    {
+        board.tiles[i].level = static_cast<int8_t>(in.read(3, CHIP_LEVELS, "tile level"));
+        board.flippedMask |= uint64_t(in.read(1)) << i;
+        readStack(in, board.tiles[i].treasure);
+    }
+
+    for (Player &player : state.players)
+    {
+        player.position = static_cast<int>(in.read(widths.tiles, tileCount, "position"));
+        player.isDead = in.read(1);
+        player.isReturning = in.read(1);
+        player.points = readPoints(in);
+        player.inventory.resize(in.read(4, MAX_INVENTORY, "inventory size"));
+        for (TreasureStack &stack : player.inventory)
+            readStack(in, stack);
+
+        if (player.position > 0) // divers never share a tile
+            board.occupiedMask |= uint64_t(1) << (player.position - 1);
+    }
+
+    for (auto &level : state.valuePools.counts)
+        for (uint8_t &copies : level)
+            copies = static_cast<uint8_t>(in.read(widths.copies, rules.copiesPerValue(), "value pool"));
+    state.valuePools.recount();
+
+    state.rehash();
+}
@@ -0,0 +1,69 @@
+#ifndef STATE_CODEC_HPP
+#define STATE_CODEC_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include "environment.hpp"
+
+constexpr uint8_t STATE_FORMAT_VERSION = 2;
+
+// The longest encoding, in bits, when a diver's points field is pointsBits wide: the fixed
+// fields and MAX_TILES tiles and MAX_PLAYERS divers at the widths listed below, a 2-bit count
+// per carried stack, and 2 bits per chip wherever it lies (a game has no more chips than tiles)
+constexpr size_t maxEncodedBits(int pointsBits)
+{
+    return 8 + 24 + 21 + 7 + MAX_TILES * 6 + MAX_PLAYERS * (13 + pointsBits) +
+           MAX_PLAYERS * MAX_INVENTORY * 2 + MAX_TILES * 2 + CHIP_LEVELS * VALUES_PER_LEVEL * 3;
+}
+
+constexpr size_t MAX_WHOLE_SCORE_STATE = (maxEncodedBits(11) + 7) / 8; // 114 bytes
+constexpr size_t MAX_ENCODED_STATE = (maxEncodedBits(65) + 7) / 8;     // 154 bytes
+static_assert(MAX_WHOLE_SCORE_STATE <= 128, "States with whole scores fit in 128 bytes");
+
+using EncodedState = FixedVector<uint8_t, MAX_ENCODED_STATE>;
+
+/**
+ * Versioned binary encoding of a State, bit-packed in field order:
+ *
+ *   version           8 bits
+ *   rules             board tiles 7, oxygen 7, rounds 4, dice count 3, dice sides 3
+ *   players           3 bits, then current player 3, last player 3, round 3, oxygen 7, valuation 2
+ *   tiles             7-bit count, then per tile: level 3, flipped 1, stack
+ *   per player        position 7, dead 1, returning 1, points, stack count 4, stacks
+ *   value pools       3 bits per (level, value), copies left
+ *
+ * A stack is a 2-bit chip count followed by 2 bits per chip level. Points take 11 bits when
+ * they are a whole number below 1024 and 65 (the raw double) otherwise. Occupied tiles are
+ * not stored: they are exactly the positions of the divers in the water.
+ *
+ * A fresh two-player game takes 52 bytes, a fresh six-player game 64, and no state with whole
+ * scores (which never reach 1024) more than MAX_WHOLE_SCORE_STATE. Only the fractional scores
+ * of ValuationPolicy::EXPECTED_VALUE, each a raw double, take a state past 128 bytes, up to
+ * MAX_ENCODED_STATE.
+ *
+ * Version 1, which predates configurable rules, is still decoded: it has no rules field,
+ * narrower round, oxygen, tile, position and pool fields, and always describes a standard game.
+ */
+class StateCodec
+{
+public:
+    static EncodedState encode(const State &state);
+
+    // overwrites state in place (no temporaries, no allocation); throws std::runtime_error on
+    // a version it does not know or on data that is truncated or out of range
+    static void decode(const uint8_t *data, size_t size, State &state);
+
+    static State decode(const uint8_t *data, size_t size)
+    {
+        State state(1);
+        decode(data, size, state);
+        return state;
+    }
+
+    static State decode(const EncodedState &encoded)
+    {
+        return decode(encoded.begin(), encoded.size());
+    }
+};
+
+#endif // STATE_CODEC_HPP
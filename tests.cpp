@@ -1,18 +1,52 @@
 #include <gtest/gtest.h>
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <set>
+#include <thread>
 #include "environment.hpp"
+#include "batch_rollout.hpp"
+#include "rollout_group.hpp"
+#include "state_codec.hpp"
+#include "pure_mcts.hpp"
+#include "mcts.hpp"
+#include "parallel_mcts.hpp"
 
 class DeepSeaAdventureTest : public ::testing::Test 
 {
     protected:
         void SetUp() override // runs before every TEST_F
         {
-            srand(42);
+            RNG::local().reseed(42); // states and engines with no injected stream draw from this one
         }
 
-        bool hasMove(const std::vector<MoveType>& moves, MoveType target) 
+        bool hasMove(const MoveList& moves, MoveType target) 
         {
-            return std::find(moves.begin(), moves.end(), target) != moves.end();
+            return moves.contains(target);
+        }
+
+    public: // for the file's free helpers as well as its tests
+        static MoveType randomMove(const State& s, bool movedThisTurn, std::mt19937& rng)
+        {
+            MoveList moves = s.getPossibleMoves(movedThisTurn);
+            return moves[std::uniform_int_distribution<size_t>(0, moves.size() - 1)(rng)];
+        }
+
+        // Plays m and updates movedThisTurn: the same player, still in the same round, owes the
+        // second half of a turn only after moving
+        static void step(State& s, MoveType m, bool& movedThisTurn, UndoRecord& undo)
+        {
+            int player = s.getCurrentPlayerIndex();
+            int round = s.getCurrentRound();
+            s.applyMove(m, undo);
+            movedThisTurn = (m == CONTINUE || m == RETURN) && s.getCurrentPlayerIndex() == player &&
+                            s.getCurrentRound() == round;
+        }
+
+        static void step(State& s, MoveType m, bool& movedThisTurn)
+        {
+            UndoRecord undo;
+            step(s, m, movedThisTurn, undo);
         }
 };
 
@@ -142,3 +176,927 @@ TEST_F(DeepSeaAdventureTest, TreasureRedistributionStacksCorrectly) {
     
     EXPECT_EQ(p.getTreasures().size(), 0);
 }
+
+TEST_F(DeepSeaAdventureTest, UndoMoveRestoresPreviousState) {
+    std::mt19937 rng(42);
+
+    for (int game = 0; game < 50; game++) {
+        State s(2 + game % 5);
+        bool movedThisTurn = false;
+        UndoRecord undo;
+        int safetyInterlock = 0;
+
+        while (!(s.isTerminal() && s.isLastRound()) && safetyInterlock++ < 1000) {
+            ASSERT_FALSE(s.getPossibleMoves(movedThisTurn).empty());
+            MoveType m = randomMove(s, movedThisTurn, rng);
+
+            State before = s;
+            step(s, m, movedThisTurn, undo);
+            State after = s;
+
+            s.undoMove(undo);
+            ASSERT_TRUE(s == before) << "undoMove did not restore the state after move " << m;
+            ASSERT_EQ(s.isTerminal(), before.isTerminal());
+
+            s = after;
+        }
+
+        EXPECT_TRUE(s.isTerminal() && s.isLastRound());
+    }
+}
+
+// The step-by-step walk Board::destination replaces, kept as the reference behaviour
+static int walkDestination(const Board &board, int position, int distance, bool &isReturning) {
+    int size = static_cast<int>(board.getTiles().size());
+    while (distance > 0) {
+        if (isReturning) {
+            if (--position <= 0)
+                return 0;
+        } else if (++position >= size) {
+            position = size;
+            isReturning = true;
+        }
+        if (!board.isTileOccupied(position))
+            distance--;
+    }
+    return position;
+}
+
+TEST_F(DeepSeaAdventureTest, MaskMovementMatchesStepWalk) {
+    std::mt19937 rng(42);
+
+    for (int trial = 0; trial < 200000; trial++) {
+        Board b;
+        int size = std::uniform_int_distribution<int>(1, MAX_TILES)(rng);
+        b.getTiles().resize(size);
+
+        int position = std::uniform_int_distribution<int>(0, size)(rng);
+        int divers = std::uniform_int_distribution<int>(0, MAX_PLAYERS - 1)(rng);
+        for (int d = 0; d < divers; d++) {
+            int tile = std::uniform_int_distribution<int>(1, size)(rng);
+            if (tile != position && !b.isTileOccupied(tile))
+                b.toggleOccupied(tile);
+        }
+
+        bool returning = std::uniform_int_distribution<int>(0, 1)(rng) == 1;
+        int distance = std::uniform_int_distribution<int>(0, 6)(rng);
+
+        bool expectedReturning = returning;
+        int expected = walkDestination(b, position, distance, expectedReturning);
+        bool actualReturning = returning;
+        int actual = b.destination(position, distance, actualReturning);
+
+        ASSERT_EQ(actual, expected) << "size " << size << " from " << position << " distance " << distance
+                                    << " returning " << returning << " occupied " << b.getOccupiedMask();
+        ASSERT_EQ(actualReturning, expectedReturning);
+    }
+}
+
+TEST_F(DeepSeaAdventureTest, MovementTableMatchesSelect) {
+    std::mt19937 rng(1234);
+
+    for (int trial = 0; trial < 200000; trial++) {
+        Board b;
+        int size = std::uniform_int_distribution<int>(0, MAX_TILES)(rng);
+        b.getTiles().resize(size);
+
+        int position = std::uniform_int_distribution<int>(0, size)(rng);
+        int divers = std::uniform_int_distribution<int>(0, 12)(rng);
+        for (int d = 0; d < divers && size > 0; d++) {
+            int tile = std::uniform_int_distribution<int>(1, size)(rng);
+            if (tile != position && !b.isTileOccupied(tile))
+                b.toggleOccupied(tile);
+        }
+
+        bool returning = std::uniform_int_distribution<int>(0, 1)(rng) == 1;
+        int distance = std::uniform_int_distribution<int>(0, 10)(rng);
+
+        bool expectedReturning = returning;
+        int expected = b.selectDestination(position, distance, expectedReturning);
+        bool actualReturning = returning;
+        int actual = b.destination(position, distance, actualReturning);
+
+        ASSERT_EQ(actual, expected) << "size " << size << " from " << position << " distance " << distance
+                                    << " returning " << returning << " occupied " << b.getOccupiedMask();
+        ASSERT_EQ(actualReturning, expectedReturning);
+    }
+}
+
+TEST_F(DeepSeaAdventureTest, IncrementalHashMatchesFullRecompute) {
+    std::mt19937 rng(7);
+
+    for (int game = 0; game < 200; game++) {
+        State s(2 + game % 5);
+        bool movedThisTurn = false;
+        UndoRecord undo;
+        int safetyInterlock = 0;
+
+        while (!(s.isTerminal() && s.isLastRound()) && safetyInterlock++ < 1000) {
+            MoveType m = randomMove(s, movedThisTurn, rng);
+
+            uint64_t before = s.getHash(movedThisTurn);
+            step(s, m, movedThisTurn, undo);
+
+            ASSERT_EQ(s.getHash(movedThisTurn), s.computeHash(movedThisTurn)) << "after move " << m;
+            ASSERT_EQ(s.getHash(false), s.computeHash(false));
+
+            bool everyoneOut = true; // the scan isTerminal used to do
+            for (const Player &p : s.getPlayers())
+                everyoneOut &= p.getIsDead() || (p.getPosition() == 0 && p.getIsReturning());
+            ASSERT_EQ(s.isTerminal(), s.getOxygen() == 0 || everyoneOut) << "after move " << m;
+            if (m != LEAVE_TREASURE && m != END) {
+                EXPECT_NE(s.getHash(movedThisTurn), before);
+            }
+        }
+    }
+}
+
+TEST_F(DeepSeaAdventureTest, HashSeparatesMovePhase) {
+    State s(3);
+    EXPECT_NE(s.getHash(false), s.getHash(true));
+
+    State copy = s;
+    EXPECT_EQ(copy.getHash(false), s.getHash(false));
+}
+
+TEST_F(DeepSeaAdventureTest, ValuePoolHandsOutEveryChipOnce) {
+    ValuePools pools;
+    RNG rng(3);
+    std::vector<int> drawn;
+    for (int i = 0; i < 8; i++) {
+        drawn.push_back(pools.draw(1, rng));
+        double left = 0;
+        for (int v = 4; v < 8; v++)
+            left += pools.remaining(1, v) * v;
+        if (i < 7) {
+            EXPECT_DOUBLE_EQ(pools.expectedValue(1), left / (7 - i)) << "The running mean must follow every draw.";
+        }
+    }
+
+    std::sort(drawn.begin(), drawn.end());
+    EXPECT_EQ(drawn, (std::vector<int>{4, 4, 5, 5, 6, 6, 7, 7}));
+    EXPECT_ANY_THROW(pools.draw(1, rng));
+    EXPECT_ANY_THROW(pools.expectedValue(1));
+    EXPECT_EQ(pools.remaining(0, 3), 2) << "Drawing level 1 chips must not touch other levels.";
+}
+
+TEST_F(DeepSeaAdventureTest, ValuationPolicyControlsPoolDraws) {
+    ValuePools pools;
+    RNG rng(5);
+    TreasureStack stack{0, 1, 3};
+
+    EXPECT_DOUBLE_EQ(Tile::calculateTreasureValue(stack, pools, ValuationPolicy::MIDPOINT, rng), 2 + 6 + 14);
+    EXPECT_DOUBLE_EQ(Tile::calculateTreasureValue(stack, pools, ValuationPolicy::EXPECTED_VALUE, rng), 1.5 + 5.5 + 13.5);
+    EXPECT_EQ(pools, ValuePools()) << "Estimated valuations must leave the pools untouched.";
+
+    double exact = Tile::calculateTreasureValue(stack, pools, ValuationPolicy::EXACT_DRAW, rng);
+    EXPECT_GE(exact, 0 + 4 + 12);
+    EXPECT_LE(exact, 3 + 7 + 15);
+    EXPECT_NE(pools, ValuePools()) << "Exact valuation draws its chips from the pools.";
+}
+
+TEST_F(DeepSeaAdventureTest, RngStreamsAreSeededAndIndependent) {
+    RNG a(99), b(99);
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(a.next(), b.next()) << "Equal seeds must give equal sequences.";
+
+    RNG parent(99);
+    RNG first = parent.split();
+    RNG second = parent.split();
+    int matches = 0;
+    for (int i = 0; i < 100; i++)
+        matches += first.next() == second.next();
+    EXPECT_EQ(matches, 0) << "Split streams must not overlap.";
+
+    std::array<int, 3> faces{};
+    for (int i = 0; i < 30000; i++) {
+        int roll = a.d3();
+        ASSERT_GE(roll, 1);
+        ASSERT_LE(roll, 3);
+        faces[roll - 1]++;
+    }
+    for (int count : faces)
+        EXPECT_NEAR(count, 10000, 500);
+}
+
+TEST_F(DeepSeaAdventureTest, InjectedRngDrivesTheDice) {
+    auto playOut = [](uint64_t seed) {
+        RNG rng(seed);
+        State s(3);
+        s.setRng(&rng);
+        std::vector<int> positions;
+        while (!(s.isTerminal() && s.isLastRound())) {
+            MoveList moves = s.getPossibleMoves(false);
+            s.applyMove(moves[0]);
+            for (const Player &p : s.getPlayers())
+                positions.push_back(p.getPosition());
+        }
+        positions.push_back(s.getPlayers()[0].getPoints());
+        return positions;
+    };
+
+    EXPECT_EQ(playOut(11), playOut(11));
+    EXPECT_NE(playOut(11), playOut(12));
+}
+
+TEST_F(DeepSeaAdventureTest, SeededGamesReplayExactly) {
+    // dice and both engines seeded the way benchmark.cpp seeds a game
+    auto playGame = [](uint64_t seed) {
+        RNG dice(seed);
+        State s(2);
+        s.setRng(&dice);
+        PureMCTS first(2, 24), second(2, 24);
+        first.setRng(dice.split());
+        second.setRng(dice.split());
+
+        std::vector<EncodedState> trace;
+        bool moved = false;
+        while (!(s.isTerminal() && s.isLastRound())) {
+            int player = s.getCurrentPlayerIndex();
+            PureMCTS &engine = player == 0 ? first : second;
+            step(s, engine.findBestMove(s, player, moved), moved);
+            trace.push_back(StateCodec::encode(s));
+        }
+        return trace;
+    };
+
+    std::vector<EncodedState> a = playGame(2024), b = playGame(2024), c = playGame(2025);
+    ASSERT_EQ(a.size(), b.size());
+    for (size_t i = 0; i < a.size(); i++)
+        ASSERT_TRUE(std::equal(a[i].begin(), a[i].end(), b[i].begin(), b[i].end())) << "diverged at move " << i;
+
+    bool differs = a.size() != c.size();
+    for (size_t i = 0; !differs && i < a.size(); i++)
+        differs = !std::equal(a[i].begin(), a[i].end(), c[i].begin(), c[i].end());
+    EXPECT_TRUE(differs);
+}
+
+// The playout BatchRollout promises to reproduce, one move at a time on a State
+static ScoreVector scalarRollout(State s, bool movedThisTurn, RolloutPolicy policy, int firstMove, RNG &rng) {
+    s.setRng(&rng);
+    if (firstMove >= 0)
+        DeepSeaAdventureTest::step(s, static_cast<MoveType>(firstMove), movedThisTurn);
+
+    while (!(s.isTerminal() && s.isLastRound())) {
+        MoveList moves = s.getPossibleMoves(movedThisTurn);
+        if (policy == RolloutPolicy::CAUTIOUS) {
+            const Player &player = s.getPlayers()[s.getCurrentPlayerIndex()];
+            int held = static_cast<int>(player.getTreasures().size());
+            bool stranded = s.getOxygen() < player.getPosition();
+            auto collect = std::find(moves.begin(), moves.end(), COLLECT_TREASURE);
+            if (collect != moves.end() && (held >= 2 || (held == 1 && s.getOxygen() <= player.getPosition())))
+                moves.erase(collect);
+            if (held >= 2 && stranded && moves.contains(DROP_TREASURE))
+                moves = {DROP_TREASURE};
+            if (moves.empty())
+                moves.push_back(LEAVE_TREASURE);
+        }
+
+        MoveType m = moves.size() == 1 ? moves[0] : moves[rng.below(moves.size())];
+        DeepSeaAdventureTest::step(s, m, movedThisTurn);
+    }
+
+    ScoreVector scores{};
+    for (size_t p = 0; p < s.getPlayers().size(); p++)
+        scores[p] = s.getPlayers()[p].getScore();
+    return scores;
+}
+
+TEST_F(DeepSeaAdventureTest, SearchTreesCarryOverToTheNextDecision) {
+    // both divers out, diver 1 carrying, then diver 0 moves again and decides about the tile it reached
+    RNG dice(4);
+    State s(2);
+    s.setRng(&dice);
+    for (MoveType m : {CONTINUE, LEAVE_TREASURE, CONTINUE, COLLECT_TREASURE, CONTINUE})
+        s.applyMove(m);
+    ASSERT_EQ(s.getPossibleMoves(true).size(), 2u);
+
+    const int iterations = 3000;
+    MCTS mcts(2, iterations);
+    mcts.setRng(RNG(1));
+    MoveType pick = mcts.findBestMove(s, 0, true);
+    EXPECT_EQ(mcts.getReusedVisits(), 0);
+
+    // the pick-up involves no dice, so diver 1's continue/return decision is already in the tree
+    State next = s.doMove(pick);
+    ASSERT_EQ(next.getPossibleMoves(false).size(), 2u);
+    mcts.findBestMove(next, 1, false);
+    EXPECT_GT(mcts.getReusedVisits(), 0);
+
+    mcts.findBestMove(State(2).doMove(CONTINUE), 0, true); // a position the tree never saw
+    EXPECT_EQ(mcts.getReusedVisits(), 0);
+
+    // the worker compacts the kept subtree to the front of its pool and frees the rest
+    MCTSWorker worker(2, iterations, 1.41, ValuationPolicy::MIDPOINT, RNG(2));
+    for (int decision = 0; decision < 2; decision++) {
+        const State &position = decision == 0 ? s : next;
+        std::vector<MoveStats> stats = worker.search(position, decision, decision == 0);
+        int visits = 0;
+        for (const MoveStats &move : stats)
+            visits += move.totalVisits;
+        // the root ends with exactly the budget, reused visits included; a kept root's first
+        // visit was its own rollout, not one through a child
+        EXPECT_EQ(visits, iterations - decision);
+        EXPECT_LE(worker.getUsedNodes(), 2 * static_cast<size_t>(iterations) + 1); // a chance node and a roll per iteration
+    }
+    EXPECT_GT(worker.getReusedVisits(), 0);
+
+    ParallelMCTS parallel(2, 2 * iterations, 1.41, 2);
+    parallel.setRng(RNG(3));
+    parallel.findBestMove(s, 0, true);
+    parallel.findBestMove(next, 1, false);
+    EXPECT_GT(parallel.getReusedVisits(), 0);
+}
+
+TEST_F(DeepSeaAdventureTest, ChanceNodesBranchOnTheRoll) {
+    const double twoD3[] = {1 / 9.0, 2 / 9.0, 3 / 9.0, 2 / 9.0, 1 / 9.0};
+    RulesConfig standard;
+    for (int roll = 2; roll <= 6; roll++)
+        EXPECT_DOUBLE_EQ(standard.rollProbability(roll), twoD3[roll - 2]);
+    EXPECT_EQ(standard.rollProbability(1), 0.0);
+
+    RulesConfig custom{32, 25, 3, 4, 3};
+    double total = 0;
+    for (int roll = custom.minRoll(); roll <= custom.maxRoll(); roll++)
+        total += custom.rollProbability(roll);
+    EXPECT_DOUBLE_EQ(total, 1.0);
+    EXPECT_DOUBLE_EQ(custom.rollProbability(3), 1 / 64.0);
+
+    // a given roll moves exactly that far
+    for (int roll = 2; roll <= 6; roll++)
+        EXPECT_EQ(State(2).doMove(CONTINUE, roll).getPlayers()[0].getPosition(), roll);
+
+    // diver 0 carries a chip and may continue or return: both moves become chance nodes
+    RNG dice(6);
+    State s(2);
+    s.setRng(&dice);
+    for (MoveType m : {CONTINUE, COLLECT_TREASURE, CONTINUE, LEAVE_TREASURE})
+        s.applyMove(m);
+    ASSERT_EQ(s.getPossibleMoves(false).size(), 2u);
+
+    MCTS mcts(2, 4000);
+    mcts.setRng(RNG(1));
+    MoveType move = mcts.findBestMove(s, 0, false);
+
+    const MCTSNode *root = mcts.getRoot();
+    ASSERT_EQ(root->children.size(), 2u);
+    for (const auto &chance : root->children) {
+        EXPECT_EQ(chance->nodeType, NodeType::CHANCE);
+        ASSERT_EQ(chance->children.size(), 5u); // a slot per roll
+        int visits = 0;
+        for (const auto &outcome : chance->children) {
+            ASSERT_NE(outcome, nullptr); // every roll was reached
+            visits += outcome->visits;
+        }
+        EXPECT_EQ(visits, chance->visits);
+    }
+
+    // whatever the dice then show, the next decision is already in the tree
+    bool moved = false;
+    step(s, move, moved);
+    if (s.getPossibleMoves(moved).size() > 1) {
+        mcts.findBestMove(s, s.getCurrentPlayerIndex(), moved);
+        EXPECT_GT(mcts.getReusedVisits(), 0);
+    }
+}
+
+namespace {
+    struct TableNode {
+        State state;
+        bool movedThisTurn;
+        int visits;
+    };
+
+    // distinct nodes below `node`, and the edges leading to them. A decision node's edge moves
+    // lead to its children; `foreign` counts the children another parent's move created.
+    void countDag(const MCTSNode *node, std::set<const MCTSNode *> &seen, int &edges, int &foreign) {
+        if (!seen.insert(node).second)
+            return;
+        if (node->nodeType == NodeType::DECISION) {
+            EXPECT_EQ(node->childMoves.size(), node->children.size());
+            for (size_t i = 0; i < node->children.size(); i++) {
+                const MCTSNode *child = node->children[i].get();
+                if (child->nodeType == NodeType::CHANCE) {
+                    EXPECT_EQ(child->moveFromParent, node->childMoves[i]);
+                    continue;
+                }
+                EXPECT_TRUE(node->state.doMove(node->childMoves[i]) == child->state);
+                if (child->moveFromParent != node->childMoves[i])
+                    foreign++;
+            }
+        }
+        for (const auto &child : node->children)
+            if (child) {
+                edges++;
+                countDag(child.get(), seen, edges, foreign);
+            }
+    }
+}
+
+TEST_F(DeepSeaAdventureTest, TranspositionsShareNodes) {
+    // the table finds positions by hash and state, phase included, and a full bucket keeps the
+    // more visited of its entries
+    TranspositionTable<TableNode> table;
+    table.resize(5);
+    EXPECT_EQ(table.capacity(), 4u);
+    State start(2);
+    State moved = start.doMove(CONTINUE, 2);
+    TableNode a{start, false, 10}, b{moved, true, 1}, c{moved, false, 0};
+    table.insert(0, &a);
+    table.insert(4, &b);
+    EXPECT_EQ(table.find(start, false, 0), &a);
+    EXPECT_EQ(table.find(start, true, 0), nullptr);
+    EXPECT_EQ(table.find(moved, true, 0), nullptr);
+    EXPECT_EQ(table.find(moved, true, 4), &b);
+    table.insert(8, &c); // same bucket: b goes, a stays
+    EXPECT_EQ(table.find(moved, true, 4), nullptr);
+    EXPECT_EQ(table.find(start, false, 0), &a);
+    EXPECT_EQ(table.find(moved, false, 8), &c);
+    EXPECT_EQ(table.size(), 2u);
+
+    // both divers out and carrying, so the dice soon bring different lines together
+    RNG dice(4);
+    State s(2);
+    s.setRng(&dice);
+    for (MoveType m : {CONTINUE, COLLECT_TREASURE, CONTINUE, COLLECT_TREASURE})
+        s.applyMove(m);
+    ASSERT_EQ(s.getPossibleMoves(false).size(), 2u);
+
+    const int iterations = 20000;
+    MCTS plain(2, iterations);
+    plain.setRng(RNG(1));
+    plain.findBestMove(s, 0, false);
+    EXPECT_EQ(plain.getTranspositionHits(), 0);
+
+    MCTS shared(2, iterations);
+    shared.setRng(RNG(1));
+    shared.setTranspositions(1 << 16);
+    MoveType move = shared.findBestMove(s, 0, false);
+    EXPECT_GT(shared.getTranspositionHits(), 0);
+    EXPECT_LT(shared.getNodesCreated(), plain.getNodesCreated());
+
+    // a DAG: some nodes have several parents, and every iteration still reaches the root once
+    std::set<const MCTSNode *> seen;
+    int edges = 0;
+    int foreign = 0;
+    countDag(shared.getRoot(), seen, edges, foreign);
+    EXPECT_GT(foreign, 0); // so a shared child's own move cannot stand for the edge
+    EXPECT_EQ(static_cast<int>(seen.size()), shared.getNodesCreated());
+    EXPECT_GT(edges + 1, static_cast<int>(seen.size()));
+    EXPECT_EQ(shared.getRoot()->visits, iterations);
+
+    // tree reuse keeps working over shared nodes
+    bool movedThisTurn = false;
+    step(s, move, movedThisTurn);
+    int player = s.getCurrentPlayerIndex();
+    if (s.getPossibleMoves(movedThisTurn).size() > 1) {
+        shared.findBestMove(s, player, movedThisTurn);
+        EXPECT_GT(shared.getReusedVisits(), 0);
+        EXPECT_EQ(shared.getRoot()->visits, iterations);
+    }
+
+    // and the worker's pool compaction over a DAG
+    MCTSWorker worker(2, iterations, 1.41, ValuationPolicy::MIDPOINT, RNG(2));
+    worker.setTranspositions(1 << 16);
+    std::vector<MoveStats> workerStats = worker.search(s, player, movedThisTurn);
+    EXPECT_GT(worker.getTranspositionHits(), 0);
+    MoveMask reported = 0;
+    for (const MoveStats &stats : workerStats)
+        reported |= MoveMask(1) << stats.move;
+    EXPECT_EQ(reported, s.getPossibleMoves(movedThisTurn).mask()); // each root move once, on its own edge
+    EXPECT_LT(static_cast<size_t>(worker.getNodesCreated()), 2 * static_cast<size_t>(iterations));
+
+    ParallelMCTS parallel(2, 2 * iterations, 1.41, 2);
+    parallel.setRng(RNG(3));
+    parallel.setTranspositions(1 << 16);
+    parallel.findBestMove(s, player, movedThisTurn);
+    EXPECT_GT(parallel.getTranspositionHits(), 0);
+}
+
+TEST_F(DeepSeaAdventureTest, TimedSearchesStopAtTheDeadlineOrWhenDecided) {
+    EXPECT_TRUE(SearchDeadline::isDecided(10, 4, 5));
+    EXPECT_FALSE(SearchDeadline::isDecided(10, 5, 5));
+    EXPECT_EQ(SearchDeadline().remainingIterations(100), std::numeric_limits<long>::max());
+    EXPECT_EQ(SearchDeadline(std::chrono::milliseconds(0)).remainingIterations(100), 0);
+
+    State s = State(2).doMove(CONTINUE);
+    auto elapsed = [](auto start) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    };
+
+    // the clock ends a search whose iteration count never would
+    MCTS unbounded(2, 100000000);
+    auto start = std::chrono::steady_clock::now();
+    unbounded.findBestMove(s, 0, true, std::chrono::milliseconds(100));
+    EXPECT_LT(elapsed(start).count(), 2000);
+    EXPECT_GT(unbounded.getLastIterations(), 0);
+    EXPECT_LT(unbounded.getLastIterations(), 100000000);
+
+    // with time to spare it stops once the leader cannot be caught, and so picks what the
+    // full count would have: clock reads draw nothing from the engine's stream
+    const int iterations = 20000;
+    MCTS full(2, iterations);
+    full.setRng(RNG(8));
+    MoveType fullMove = full.findBestMove(s, 0, true);
+    MCTS timed(2, iterations);
+    timed.setRng(RNG(8));
+    EXPECT_EQ(timed.findBestMove(s, 0, true, std::chrono::milliseconds(600000)), fullMove);
+    EXPECT_LT(timed.getLastIterations(), iterations);
+
+    MCTSWorker worker(2, iterations, 1.41, ValuationPolicy::MIDPOINT, RNG(9));
+    std::vector<MoveStats> stats = worker.search(s, 0, true, SearchDeadline(std::chrono::milliseconds(600000)));
+    EXPECT_LT(worker.getLastIterations(), iterations);
+    int visits = 0;
+    for (const MoveStats &move : stats)
+        visits += move.totalVisits;
+    EXPECT_EQ(visits, worker.getLastIterations());
+
+    ParallelMCTS parallel(2, 10000000, 1.41, 2);
+    start = std::chrono::steady_clock::now();
+    parallel.findBestMove(s, 0, true, std::chrono::milliseconds(100));
+    EXPECT_LT(elapsed(start).count(), 500); // its workers are built, and their pools sized, before the clock starts
+    EXPECT_GT(parallel.getLastIterations(), 0);
+
+    PureMCTS pure(2, 1000000);
+    start = std::chrono::steady_clock::now();
+    pure.findBestMove(s, 0, true, std::chrono::milliseconds(100));
+    EXPECT_LT(elapsed(start).count(), 2000);
+    EXPECT_GT(pure.getLastRollouts(), 0);
+    EXPECT_LT(pure.getLastRollouts(), 1000000);
+
+    // and a Pure MC search the clock does not cut short picks the fixed count's move, though it
+    // interleaves the moves' rollouts in rounds; small counts keep the decisions close
+    for (int game = 17; game < 20; game++) {
+        RNG dice(game);
+        State position(2);
+        position.setRng(&dice);
+        bool moved = false;
+        for (int ply = 0; ply < 60 && !(position.isTerminal() && position.isLastRound()); ply++) {
+            MoveList moves = position.getPossibleMoves(moved);
+            int player = position.getCurrentPlayerIndex();
+            if (moves.size() > 1 && ply % 5 == 0) {
+                for (int seed = 0; seed < 3; seed++) {
+                    PureMCTS fixedPure(2, 100);
+                    fixedPure.setRng(RNG(seed));
+                    MoveType fixedMove = fixedPure.findBestMove(position, player, moved);
+                    PureMCTS timedPure(2, 100);
+                    timedPure.setRng(RNG(seed));
+                    EXPECT_EQ(timedPure.findBestMove(position, player, moved, std::chrono::milliseconds(600000)),
+                              fixedMove)
+                        << "game " << game << ", ply " << ply << ", seed " << seed;
+                }
+            }
+
+            step(position, moves[dice.below(moves.size())], moved);
+        }
+    }
+
+    // a long worker search outgrows its pool, which moves the tree without losing any of it
+    MCTSWorker deep(2, 100000, 1.41, ValuationPolicy::MIDPOINT, RNG(10));
+    stats = deep.search(s, 0, true);
+    EXPECT_GT(deep.getUsedNodes(), 100000u);
+    visits = 0;
+    for (const MoveStats &move : stats)
+        visits += move.totalVisits;
+    EXPECT_EQ(visits, 100000);
+}
+
+namespace {
+    struct SharedTreeCheck {
+        int nodes = 0;
+        long leafVisits = 0; // visits that ended their iteration at the node itself
+    };
+
+    // Every backed-up iteration passed once through each node on its path and ended at exactly
+    // one of them. Claimed moves are published and no thread is still counted below a node.
+    void checkSharedNode(const SharedTreeNode *node, bool isRoot, SharedTreeCheck &check) {
+        EXPECT_EQ(node->virtualLoss.load(), 0);
+        for (const auto &w : node->wins) {
+            EXPECT_GE(w.load(), 0.0);
+            EXPECT_LE(w.load(), node->visits.load() + 1e-9);
+        }
+        check.nodes++;
+
+        int childVisits = 0;
+        for (int i = 0; i < node->slotCount; i++) {
+            const SharedTreeNode *child = node->child(i);
+            if (child == nullptr)
+                continue;
+            childVisits += child->visits.load();
+            checkSharedNode(child, false, check);
+        }
+
+        int own = node->visits.load() - childVisits;
+        EXPECT_GE(own, 0);
+        if (node->isTerminal()) {
+            EXPECT_EQ(childVisits, 0);
+        } else if (node->nodeType == NodeType::CHANCE) {
+            EXPECT_EQ(own, 0);
+        } else if (!isRoot) {
+            EXPECT_GE(own, 1); // the iteration that created it
+        }
+        check.leafVisits += own;
+
+        if (node->nodeType == NodeType::DECISION) {
+            MoveMask legal = node->state.getPossibleMoves(node->movedThisTurn).mask();
+            MoveMask untried = node->unexpandedMoves.load();
+            EXPECT_EQ(untried & ~legal, 0);
+            for (int m = 0; m < SharedTreeNode::MOVE_SLOTS; m++) {
+                bool claimed = (legal >> m & 1) && !(untried >> m & 1);
+                EXPECT_EQ(node->child(m) != nullptr, claimed);
+            }
+        }
+    }
+
+    SharedTreeCheck checkSharedTree(const SharedTreeSearch &search) {
+        SharedTreeCheck check;
+        checkSharedNode(search.getRoot(), true, check);
+        EXPECT_EQ(check.nodes, static_cast<int>(search.getUsedNodes()));
+        EXPECT_EQ(check.leafVisits, search.getLastIterations());
+        return check;
+    }
+}
+
+TEST_F(DeepSeaAdventureTest, SharedTreeThreadsSearchOneTree) {
+    RNG dice(6);
+    State s(3);
+    s.setRng(&dice);
+    // the third diver has just moved and must leave or collect
+    for (MoveType m : {CONTINUE, LEAVE_TREASURE, CONTINUE, COLLECT_TREASURE, CONTINUE})
+        s.applyMove(m);
+
+    const int iterations = 20000;
+    SharedTreeSearch shared(3, iterations, 4, 1.41, ValuationPolicy::MIDPOINT, RNG(1));
+    for (int search = 0; search < 2; search++) { // the second starts over in the same arena
+        std::vector<MoveStats> stats = shared.search(s, 2, true);
+        int visits = 0;
+        for (const MoveStats &move : stats)
+            visits += move.totalVisits;
+        EXPECT_LE(visits, iterations);
+        EXPECT_GT(visits, iterations / 2);
+        EXPECT_EQ(shared.getLastIterations(), iterations);
+        EXPECT_EQ(shared.getRoot()->visits.load(), iterations);
+        checkSharedTree(shared);
+    }
+
+    // a deadline stops all threads
+    SharedTreeSearch timed(3, 100000000, 4, 1.41, ValuationPolicy::MIDPOINT, RNG(2));
+    timed.search(s, 2, true, SearchDeadline(std::chrono::milliseconds(100)));
+    EXPECT_GT(timed.getLastIterations(), 0);
+    EXPECT_LT(timed.getLastIterations(), 100000000);
+    checkSharedTree(timed);
+
+    // selectable next to root parallelism, with the same iteration budget
+    ParallelMCTS parallel(3, 8000, 1.41, 4);
+    parallel.setRng(RNG(3));
+    EXPECT_EQ(parallel.getMode(), ParallelMode::ROOT);
+    parallel.setMode(ParallelMode::TREE);
+    MoveType move = parallel.findBestMove(s, 2, true);
+    EXPECT_TRUE(s.getPossibleMoves(true).contains(move));
+    EXPECT_EQ(parallel.getLastIterations(), 8000);
+}
+
+TEST_F(DeepSeaAdventureTest, SharedTreeExpansionSurvivesContention) {
+    // a last round with little oxygen: the tree is small enough that 64 threads keep racing
+    // for the same untried moves and roll slots
+    RulesConfig rules;
+    rules.rounds = 1;
+    rules.oxygen = 4;
+    RNG dice(11);
+    State s(4, rules);
+    s.setRng(&dice);
+    s.applyMove(CONTINUE);
+
+    for (int seed = 0; seed < 3; seed++) {
+        const int iterations = 30000;
+        SharedTreeSearch shared(4, iterations, 64, 1.41, ValuationPolicy::MIDPOINT, RNG(seed));
+        std::vector<MoveStats> stats = shared.search(s, 0, true);
+        EXPECT_EQ(shared.getLastIterations(), iterations);
+
+        SharedTreeCheck check = checkSharedTree(shared);
+        EXPECT_GT(check.nodes, 1);
+
+        // an iteration ends at the root while every root move is claimed but none is published
+        int visits = 0;
+        for (const MoveStats &move : stats)
+            visits += move.totalVisits;
+        EXPECT_LE(visits, iterations);
+        EXPECT_GT(visits, iterations / 2);
+    }
+}
+
+TEST_F(DeepSeaAdventureTest, BatchRolloutMatchesScalarPlayouts) {
+    std::mt19937 rng(2024);
+    const ValuationPolicy policies[] = {ValuationPolicy::EXACT_DRAW, ValuationPolicy::MIDPOINT,
+                                        ValuationPolicy::EXPECTED_VALUE};
+
+    // standard rules, a 64-tile board whose 3d4 rolls overrun the movement tables, a short 1d6 game
+    const RulesConfig variants[] = {RulesConfig(), RulesConfig{64, 64, 3, 4, 4}, RulesConfig{48, 40, 1, 6, 2}};
+
+    for (int trial = 0; trial < 90; trial++) {
+        // a random position somewhere in the game
+        RNG prefixRng(trial);
+        State s(2 + trial % 5, variants[trial / 3 % 3]);
+        s.setRng(&prefixRng);
+        s.setValuationPolicy(policies[trial % 3]);
+        bool movedThisTurn = false;
+        int prefix = std::uniform_int_distribution<int>(0, 150)(rng);
+        for (int i = 0; i < prefix && !(s.isTerminal() && s.isLastRound()); i++)
+            step(s, randomMove(s, movedThisTurn, rng), movedThisTurn);
+        s.setRng(nullptr);
+
+        RolloutPolicy policy = trial % 2 ? RolloutPolicy::CAUTIOUS : RolloutPolicy::UNIFORM;
+        BatchRollout batch(policy);
+
+        // every other position also pins the first decision to its last legal move
+        int firstMove = -1;
+        MoveList moves = s.getPossibleMoves(movedThisTurn);
+        if (trial % 4 >= 2 && !s.isTerminal() && !moves.empty())
+            firstMove = moves.back();
+
+        const int count = 37; // not a multiple of the lane count
+        std::vector<ScoreVector> batched(count);
+        RNG batchStream(1000 + trial);
+        if (firstMove >= 0)
+            batch.runAfter(s, movedThisTurn, static_cast<MoveType>(firstMove), count, batchStream, batched.data());
+        else
+            batch.run(s, movedThisTurn, count, batchStream, batched.data());
+
+        RNG scalarStream(1000 + trial);
+        for (int i = 0; i < count; i++) {
+            RNG laneRng(scalarStream.next());
+            ASSERT_EQ(batched[i], scalarRollout(s, movedThisTurn, policy, firstMove, laneRng))
+                << "trial " << trial << " rollout " << i;
+        }
+    }
+}
+
+TEST_F(DeepSeaAdventureTest, LeafParallelRolloutsMatchOneBatch) {
+    State s = State(4).doMove(CONTINUE);
+    s.setRng(nullptr);
+
+    const int count = 45;
+    std::vector<ScoreVector> expected(count);
+    RNG expectedStream(77);
+    BatchRollout(RolloutPolicy::CAUTIOUS).run(s, true, count, expectedStream, expected.data());
+
+    for (int workers : {1, 2, 3, 8}) {
+        RolloutGroup group(workers, RolloutPolicy::CAUTIOUS);
+        for (int repeat = 0; repeat < 3; repeat++) { // the workers serve one job after another
+            std::vector<ScoreVector> scores(count);
+            RNG stream(77);
+            group.run(s, true, count, stream, scores.data());
+            for (int i = 0; i < count; i++)
+                EXPECT_EQ(scores[i], expected[i]) << workers << " workers, rollout " << i;
+            EXPECT_EQ(stream.next(), RNG(expectedStream).next()); // the stream ends past every rollout
+        }
+    }
+
+    // a search with leaf-parallel rollouts grows the tree of the serial search
+    MCTS serial(4, 3000);
+    serial.setRng(RNG(5));
+    serial.setRolloutsPerLeaf(8);
+    MoveType serialMove = serial.findBestMove(s, 0, true);
+
+    MCTS leaf(4, 3000);
+    leaf.setRng(RNG(5));
+    leaf.setLeafParallelism(8, 3);
+    EXPECT_EQ(leaf.findBestMove(s, 0, true), serialMove);
+    ASSERT_EQ(leaf.getRoot()->children.size(), serial.getRoot()->children.size());
+    for (size_t i = 0; i < serial.getRoot()->children.size(); i++) {
+        EXPECT_EQ(leaf.getRoot()->children[i]->visits, serial.getRoot()->children[i]->visits);
+        EXPECT_DOUBLE_EQ(leaf.getRoot()->children[i]->wins[0], serial.getRoot()->children[i]->wins[0]);
+    }
+}
+
+TEST_F(DeepSeaAdventureTest, RulesConfigShapesTheGame) {
+    RulesConfig rules{64, 40, 3, 4, 5};
+    State s(3, rules);
+    EXPECT_EQ(s.getRules(), rules);
+    EXPECT_EQ(s.getOxygen(), 40);
+    ASSERT_EQ(s.getBoard().getTiles().size(), 64u);
+    for (int i = 0; i < 64; i++)
+        EXPECT_EQ(s.getBoard().getTiles()[i].level, i / 16);
+    EXPECT_NE(s, State(3)); // same position, different game
+
+    // 3d4: the first diver lands on the roll itself
+    for (int seed = 0; seed < 50; seed++) {
+        RNG dice(seed);
+        State t(3, rules);
+        t.setRng(&dice);
+        t.applyMove(CONTINUE);
+        EXPECT_GE(t.getPlayers()[0].getPosition(), 3);
+        EXPECT_LE(t.getPlayers()[0].getPosition(), 12);
+    }
+
+    // random play lasts exactly five rounds, each starting with a full tank
+    std::mt19937 rng(8);
+    bool movedThisTurn = false;
+    int rounds = 1;
+    while (!(s.isTerminal() && s.isLastRound())) {
+        int prevRound = s.getCurrentRound();
+        step(s, randomMove(s, movedThisTurn, rng), movedThisTurn);
+        if (s.getCurrentRound() != prevRound) {
+            rounds++;
+            EXPECT_EQ(s.getOxygen(), 40);
+            EXPECT_EQ(s.getValuePools().expectedValue(0), 1.5);
+        }
+    }
+    EXPECT_EQ(rounds, 5);
+
+    EXPECT_THROW(State(2, RulesConfig{40, 25, 2, 3, 3}), std::runtime_error); // not a multiple of 16
+    EXPECT_THROW(State(2, RulesConfig{128, 25, 2, 3, 3}), std::runtime_error); // wider than the masks
+    EXPECT_THROW(State(2, RulesConfig{32, 65, 2, 3, 3}), std::runtime_error);
+    EXPECT_THROW(State(2, RulesConfig{32, 25, 0, 3, 3}), std::runtime_error);
+}
+
+TEST_F(DeepSeaAdventureTest, StateCodecRoundTrips) {
+    std::mt19937 rng(77);
+    const ValuationPolicy policies[] = {ValuationPolicy::EXACT_DRAW, ValuationPolicy::MIDPOINT,
+                                        ValuationPolicy::EXPECTED_VALUE};
+    size_t largest = 0, largestWhole = 0;
+
+    for (int game = 0; game < 30; game++) {
+        RNG dice(game);
+        State s(1 + game % MAX_PLAYERS, game % 5 == 4 ? RulesConfig{64, 64, 3, 3, 8} : RulesConfig());
+        s.setRng(&dice);
+        s.setValuationPolicy(policies[game % 3]); // EXPECTED_VALUE leaves fractional scores
+        bool movedThisTurn = false;
+
+        while (true) {
+            EncodedState encoded = StateCodec::encode(s);
+            largest = std::max(largest, encoded.size());
+            if (policies[game % 3] != ValuationPolicy::EXPECTED_VALUE)
+                largestWhole = std::max(largestWhole, encoded.size());
+
+            State decoded = StateCodec::decode(encoded);
+            ASSERT_EQ(decoded, s);
+            ASSERT_EQ(decoded.getHash(false), s.getHash(false));
+            ASSERT_EQ(decoded.getBoard().getOccupiedMask(), s.getBoard().getOccupiedMask());
+
+            if (s.isTerminal() && s.isLastRound())
+                break;
+
+            step(s, randomMove(s, movedThisTurn, rng), movedThisTurn);
+        }
+    }
+
+    EXPECT_LE(largestWhole, MAX_WHOLE_SCORE_STATE);
+    EXPECT_LE(largest, MAX_ENCODED_STATE);
+
+    // decoding overwrites whatever the target held
+    State target(4);
+    target.applyMove(CONTINUE);
+    State fresh(2);
+    EncodedState encoded = StateCodec::encode(fresh);
+    StateCodec::decode(encoded.begin(), encoded.size(), target);
+    EXPECT_EQ(target, fresh);
+
+    // a version 1 encoding, from before the rules were configurable, still reads as a standard game
+    const uint8_t version1[] = {0x01, 0x0A, 0xC8, 0x80, 0x10, 0x10, 0x08, 0x04, 0x04, 0x04, 0x04, 0x44,
+                                0x54, 0x54, 0x54, 0x54, 0x54, 0x54, 0x54, 0x94, 0xA4, 0xA4, 0xA4, 0xA4,
+                                0xA4, 0xA4, 0xA4, 0xE4, 0xF4, 0xF4, 0xF4, 0xF4, 0xF4, 0xF4, 0xF4, 0xF4,
+                                0x40, 0x00, 0x22, 0x00, 0x02, 0x00, 0xAA, 0xAA, 0xAA, 0xAA};
+    RNG dice(5);
+    State played(2);
+    played.setRng(&dice);
+    played.applyMove(CONTINUE);
+    played.applyMove(COLLECT_TREASURE);
+    EXPECT_EQ(StateCodec::decode(version1, sizeof version1), played);
+}
+
+TEST_F(DeepSeaAdventureTest, StateCodecRejectsBadInput) {
+    EncodedState encoded = StateCodec::encode(State(3));
+
+    EncodedState future = encoded;
+    future[0] = STATE_FORMAT_VERSION + 1;
+    EXPECT_THROW(StateCodec::decode(future), std::runtime_error);
+
+    EXPECT_THROW(StateCodec::decode(encoded.begin(), encoded.size() - 1), std::runtime_error);
+    EXPECT_THROW(StateCodec::decode(encoded.begin(), 0), std::runtime_error);
+}
+
+TEST_F(DeepSeaAdventureTest, IndependentGamesRunConcurrently) {
+    auto playGames = [](unsigned seed, int &finished) {
+        std::mt19937 rng(seed);
+        for (int game = 0; game < 100; game++) {
+            State s(2 + game % 5);
+            bool movedThisTurn = false;
+            int safetyInterlock = 0;
+            while (!(s.isTerminal() && s.isLastRound()) && safetyInterlock++ < 1000)
+                step(s, randomMove(s, movedThisTurn, rng), movedThisTurn);
+            if (s.isTerminal() && s.isLastRound())
+                finished++;
+        }
+    };
+
+    std::vector<int> finished(4, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+        threads.emplace_back(playGames, 100 + t, std::ref(finished[t]));
+    for (auto &thread : threads)
+        thread.join();
+
+    for (int count : finished)
+        EXPECT_EQ(count, 100);
+}
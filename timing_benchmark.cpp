@@ -0,0 +1,567 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <string>
+#include "environment.hpp"
+#include "batch_rollout.hpp"
+#include "state_codec.hpp"
+#include "mcts.hpp"
+#include "parallel_mcts.hpp"
+
+// Microbenchmarks for the hot paths of the engine. Each case reports nanoseconds per call
+// and a checksum so the compiler cannot drop the work.
+
+template <typename F>
+double timeSeconds(F &&body)
+{
+    auto start = std::chrono::steady_clock::now();
+    body();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void report(const std::string &name, double seconds, long long calls, uint64_t checksum)
+{
+    std::cout << "  " << std::left << std::setw(28) << name << std::right
+              << std::fixed << std::setprecision(2) << std::setw(10) << seconds * 1e9 / calls << " ns/call"
+              << "   (checksum " << checksum << ")\n";
+}
+
+// ---------------------------------------------------------------- movement
+
+struct MoveCase
+{
+    Board board;
+    int position;
+    int distance;
+    bool isReturning;
+};
+
+// The original tile-by-tile walk of Player::move
+static int walkDestination(const Board &board, int position, int distance, bool &isReturning)
+{
+    int size = static_cast<int>(board.getTiles().size());
+    while (distance > 0)
+    {
+        if (isReturning)
+        {
+            if (--position <= 0)
+                return 0;
+        }
+        else if (++position >= size)
+        {
+            position = size;
+            isReturning = true;
+        }
+        if (!board.isTileOccupied(position))
+            distance--;
+    }
+    return position;
+}
+
+std::vector<MoveCase> makeMoveCases(int count, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<MoveCase> cases;
+    cases.reserve(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        MoveCase c;
+        int size = std::uniform_int_distribution<int>(8, BOARD_TILES)(rng);
+        c.board.getTiles().resize(size);
+        c.position = std::uniform_int_distribution<int>(0, size)(rng);
+
+        int divers = std::uniform_int_distribution<int>(0, MAX_PLAYERS - 1)(rng);
+        for (int d = 0; d < divers; d++)
+        {
+            int tile = std::uniform_int_distribution<int>(1, size)(rng);
+            if (tile != c.position && !c.board.isTileOccupied(tile))
+                c.board.toggleOccupied(tile);
+        }
+
+        // two d3 minus a typical burden
+        c.distance = std::max(0, std::uniform_int_distribution<int>(2, 6)(rng) -
+                                     std::uniform_int_distribution<int>(0, 2)(rng));
+        c.isReturning = std::uniform_int_distribution<int>(0, 1)(rng) == 1;
+        cases.push_back(c);
+    }
+    return cases;
+}
+
+template <typename Kernel>
+void benchmarkMovement(const std::string &name, const std::vector<MoveCase> &cases, int repeats, Kernel kernel)
+{
+    uint64_t checksum = 0;
+    double seconds = timeSeconds([&]()
+                                 {
+        for (int r = 0; r < repeats; r++)
+            for (const MoveCase &c : cases)
+            {
+                bool returning = c.isReturning;
+                checksum += kernel(c, returning) * 2 + returning;
+            } });
+    report(name, seconds, static_cast<long long>(repeats) * cases.size(), checksum);
+}
+
+void movementBenchmarks()
+{
+    std::cout << "Movement (random boards, distance 0..6):\n";
+    std::vector<MoveCase> cases = makeMoveCases(1 << 14, 42);
+    const int repeats = 200;
+
+    benchmarkMovement("step walk", cases, repeats, [](const MoveCase &c, bool &returning)
+                      { return walkDestination(c.board, c.position, c.distance, returning); });
+    benchmarkMovement("popcount/select", cases, repeats, [](const MoveCase &c, bool &returning)
+                      { return c.board.selectDestination(c.position, c.distance, returning); });
+    benchmarkMovement("lookup table", cases, repeats, [](const MoveCase &c, bool &returning)
+                      { return c.board.destination(c.position, c.distance, returning); });
+}
+
+// ---------------------------------------------------------------- dice
+
+void diceBenchmarks()
+{
+    std::cout << "Dice (one 2d3 throw):\n";
+    const int throws = 20000000;
+
+    std::mt19937 mt(42);
+    std::uniform_int_distribution<int> d3(1, 3);
+    uint64_t checksum = 0;
+    double seconds = timeSeconds([&]()
+                                 {
+        for (int i = 0; i < throws; i++)
+            checksum += d3(mt) + d3(mt); });
+    report("mt19937 + distribution", seconds, throws, checksum);
+
+    RNG rng(42);
+    checksum = 0;
+    seconds = timeSeconds([&]()
+                          {
+        for (int i = 0; i < throws; i++)
+            checksum += rng.d3() + rng.d3(); });
+    report("xoshiro256** d3", seconds, throws, checksum);
+}
+
+// ---------------------------------------------------------------- rollouts
+
+// Uniformly random playout over State, the scalar path the batch simulator replaces
+static ScoreVector scalarRollout(State state, bool movedThisTurn, RNG &rng)
+{
+    state.setRng(&rng);
+    while (!(state.isTerminal() && state.isLastRound()))
+    {
+        MoveList moves = state.getPossibleMoves(movedThisTurn);
+        MoveType move = moves.size() == 1 ? moves[0] : moves[rng.below(moves.size())];
+        int prevPlayer = state.getCurrentPlayerIndex();
+        int prevRound = state.getCurrentRound();
+        state.applyMove(move);
+        movedThisTurn = (move == CONTINUE || move == RETURN) && state.getCurrentPlayerIndex() == prevPlayer &&
+                        state.getCurrentRound() == prevRound;
+    }
+
+    ScoreVector scores{};
+    for (size_t p = 0; p < state.getPlayers().size(); p++)
+        scores[p] = state.getPlayers()[p].getScore();
+    return scores;
+}
+
+void rolloutBenchmarks()
+{
+    std::cout << "Rollouts (random playout to the end of the game):\n";
+    const int rollouts = 20000;
+
+    for (int players : {2, 4, 6})
+    {
+        State state(players);
+        state.setValuationPolicy(ValuationPolicy::MIDPOINT);
+
+        RNG rng(7);
+        double checksum = 0;
+        double seconds = timeSeconds([&]()
+                                     {
+            for (int i = 0; i < rollouts; i++)
+                checksum += scalarRollout(state, false, rng)[0]; });
+        report(std::to_string(players) + " players, State", seconds, rollouts, static_cast<uint64_t>(checksum));
+
+        BatchRollout batch;
+        std::vector<ScoreVector> scores(rollouts);
+        checksum = 0;
+        seconds = timeSeconds([&]()
+                              {
+            batch.run(state, false, rollouts, rng, scores.data());
+            for (const ScoreVector &s : scores)
+                checksum += s[0]; });
+        report(std::to_string(players) + " players, batched", seconds, rollouts, static_cast<uint64_t>(checksum));
+
+        batch.setSpecialized(false);
+        checksum = 0;
+        seconds = timeSeconds([&]()
+                              {
+            batch.run(state, false, rollouts, rng, scores.data());
+            for (const ScoreVector &s : scores)
+                checksum += s[0]; });
+        report(std::to_string(players) + " players, batched generic", seconds, rollouts,
+               static_cast<uint64_t>(checksum));
+    }
+}
+
+// ---------------------------------------------------------------- codec
+
+void codecBenchmarks()
+{
+    std::cout << "State codec (positions from random 4-player games):\n";
+
+    std::vector<State> positions;
+    RNG rng(5);
+    while (positions.size() < 4096)
+    {
+        State state(4);
+        state.setRng(&rng);
+        bool movedThisTurn = false;
+        while (!(state.isTerminal() && state.isLastRound()))
+        {
+            positions.push_back(state);
+            MoveList moves = state.getPossibleMoves(movedThisTurn);
+            MoveType move = moves[rng.below(moves.size())];
+            int prevPlayer = state.getCurrentPlayerIndex();
+            state.applyMove(move);
+            movedThisTurn = (move == CONTINUE || move == RETURN) && state.getCurrentPlayerIndex() == prevPlayer;
+        }
+    }
+
+    const int repeats = 50;
+    std::vector<EncodedState> encoded(positions.size());
+    uint64_t checksum = 0;
+    double seconds = timeSeconds([&]()
+                                 {
+        for (int r = 0; r < repeats; r++)
+            for (size_t i = 0; i < positions.size(); i++)
+            {
+                encoded[i] = StateCodec::encode(positions[i]);
+                checksum += encoded[i].size();
+            } });
+    report("encode", seconds, static_cast<long long>(repeats) * positions.size(), checksum);
+    std::cout << "  average size " << std::fixed << std::setprecision(1)
+              << static_cast<double>(checksum) / (repeats * positions.size()) << " bytes\n";
+
+    State decoded(1);
+    checksum = 0;
+    seconds = timeSeconds([&]()
+                          {
+        for (int r = 0; r < repeats; r++)
+            for (const EncodedState &e : encoded)
+            {
+                StateCodec::decode(e.begin(), e.size(), decoded);
+                checksum += decoded.getOxygen();
+            } });
+    report("decode", seconds, static_cast<long long>(repeats) * encoded.size(), checksum);
+}
+
+// ---------------------------------------------------------------- terminal check
+
+// The player scan State::isTerminal did before it kept a count of the players out of the round
+static bool scanTerminal(const State &state)
+{
+    if (state.getOxygen() == 0)
+        return true;
+
+    for (const Player &p : state.getPlayers())
+        if (!p.getIsDead() && (p.getPosition() > 0 || !p.getIsReturning()))
+            return false;
+    return true;
+}
+
+void terminalBenchmarks()
+{
+    std::cout << "Terminal check (positions from random 6-player games):\n";
+
+    std::vector<State> positions;
+    RNG rng(3);
+    while (positions.size() < 4096)
+    {
+        State state(6);
+        state.setRng(&rng);
+        bool movedThisTurn = false;
+        while (!(state.isTerminal() && state.isLastRound()))
+        {
+            positions.push_back(state);
+            MoveList moves = state.getPossibleMoves(movedThisTurn);
+            MoveType move = moves[rng.below(moves.size())];
+            int prevPlayer = state.getCurrentPlayerIndex();
+            state.applyMove(move);
+            movedThisTurn = (move == CONTINUE || move == RETURN) && state.getCurrentPlayerIndex() == prevPlayer;
+        }
+    }
+
+    const int repeats = 500;
+    uint64_t checksum = 0;
+    double seconds = timeSeconds([&]()
+                                 {
+        for (int r = 0; r < repeats; r++)
+            for (const State &state : positions)
+                checksum += scanTerminal(state); });
+    report("player scan", seconds, static_cast<long long>(repeats) * positions.size(), checksum);
+
+    checksum = 0;
+    seconds = timeSeconds([&]()
+                          {
+        for (int r = 0; r < repeats; r++)
+            for (const State &state : positions)
+                checksum += state.isTerminal(); });
+    report("safe count", seconds, static_cast<long long>(repeats) * positions.size(), checksum);
+}
+
+// ---------------------------------------------------------------- round transition
+
+void roundBenchmarks()
+{
+    std::cout << "Round transition (late positions from random 4-player games, oxygen runs out):\n";
+
+    std::vector<State> positions;
+    RNG rng(9);
+    while (positions.size() < 4096)
+    {
+        State state(4);
+        state.setRng(&rng);
+        state.setValuationPolicy(ValuationPolicy::MIDPOINT);
+        bool movedThisTurn = false;
+        while (!state.isLastRound())
+        {
+            if (state.getOxygen() < 12) // blanks on the path and divers still out with chips
+                positions.push_back(state);
+            MoveList moves = state.getPossibleMoves(movedThisTurn);
+            MoveType move = moves[rng.below(moves.size())];
+            int prevPlayer = state.getCurrentPlayerIndex();
+            state.applyMove(move);
+            movedThisTurn = (move == CONTINUE || move == RETURN) && state.getCurrentPlayerIndex() == prevPlayer;
+        }
+    }
+
+    const int repeats = 200;
+    uint64_t checksum = 0;
+    double seconds = timeSeconds([&]()
+                                 {
+        for (int r = 0; r < repeats; r++)
+            for (const State &position : positions)
+            {
+                State state = position;
+                state.reset();
+                checksum += state.getBoard().getTiles().size() + state.getHash(false);
+            } });
+    report("copy + reset", seconds, static_cast<long long>(repeats) * positions.size(), checksum);
+}
+
+// ---------------------------------------------------------------- search
+
+void searchBenchmarks()
+{
+    std::cout << "Search (MCTS on the first pick-up decision):\n";
+    for (int players : {2, 4, 6})
+    {
+        const int iterations = 20000;
+        State state = State(players).doMove(CONTINUE);
+        MCTS mcts(players, iterations);
+
+        MoveType move = CONTINUE;
+        double seconds = timeSeconds([&]()
+                                     { move = mcts.findBestMove(state, 0, true); });
+        std::cout << "  " << players << " players: " << std::fixed << std::setprecision(0)
+                  << iterations / seconds << " iterations/s (chose " << move << ")\n";
+    }
+}
+
+void transpositionBenchmarks()
+{
+    std::cout << "Transpositions (MCTS on the first pick-up decision, plain tree vs a shared-node table):\n";
+    for (int players : {2, 4})
+    {
+        for (size_t entries : {size_t(0), size_t(1) << 16, size_t(1) << 20})
+        {
+            const int iterations = 50000;
+            State state = State(players).doMove(CONTINUE);
+            MCTS mcts(players, iterations);
+            mcts.setRng(RNG(5));
+            mcts.setTranspositions(entries);
+
+            double seconds = timeSeconds([&]()
+                                         { mcts.findBestMove(state, 0, true); });
+            int nodes = mcts.getNodesCreated();
+            int hits = mcts.getTranspositionHits();
+            std::cout << "  " << players << " players, " << std::setw(7) << entries << " slots: " << std::setw(7)
+                      << nodes << " nodes, " << std::setw(6) << hits << " shared (" << std::fixed
+                      << std::setprecision(1) << std::setw(4) << 100.0 * hits / (nodes + hits) << "%), "
+                      << std::setprecision(0) << iterations / seconds << " iterations/s\n";
+        }
+    }
+}
+
+void deadlineBenchmarks()
+{
+    std::cout << "Deadlines (MCTS, 3 players, decisions early and late in a random game; fixed count vs 20 ms):\n";
+    RNG dice(3);
+    State state(3);
+    state.setRng(&dice);
+    bool movedThisTurn = false;
+    int decision = 0;
+    for (int ply = 0; ply < 400 && !(state.isTerminal() && state.isLastRound()); ply++)
+    {
+        MoveList moves = state.getPossibleMoves(movedThisTurn);
+        int player = state.getCurrentPlayerIndex();
+        if (moves.size() > 1 && decision++ % 12 == 0)
+        {
+            const int iterations = 10000;
+            MCTS fixed(3, iterations);
+            fixed.setRng(RNG(1));
+            double fixedSeconds = timeSeconds([&]()
+                                              { fixed.findBestMove(state, player, movedThisTurn); });
+
+            MCTS timed(3, 10000000);
+            timed.setRng(RNG(1));
+            double timedSeconds = timeSeconds([&]()
+                                              { timed.findBestMove(state, player, movedThisTurn, std::chrono::milliseconds(20)); });
+
+            std::cout << "  round " << state.getCurrentRound() + 1 << ", oxygen " << std::setw(2) << state.getOxygen()
+                      << ": " << std::fixed << std::setprecision(1) << std::setw(6) << fixedSeconds * 1e3 << " ms for "
+                      << iterations << " iterations, " << std::setw(5) << timedSeconds * 1e3 << " ms for "
+                      << std::setw(6) << timed.getLastIterations() << " timed\n";
+        }
+
+        MoveType move = moves[dice.below(moves.size())];
+        int round = state.getCurrentRound();
+        state.applyMove(move);
+        movedThisTurn = (move == CONTINUE || move == RETURN) && state.getCurrentPlayerIndex() == player &&
+                        state.getCurrentRound() == round;
+    }
+}
+
+void parallelBenchmarks()
+{
+    std::cout << "Parallel search (3 players, first pick-up decision, 40000 iterations; root vs shared tree):\n";
+    State state = State(3).doMove(CONTINUE);
+    for (int threads = 1; threads <= 64; threads *= 2)
+    {
+        std::cout << "  " << std::setw(2) << threads << " threads:";
+        for (ParallelMode mode : {ParallelMode::ROOT, ParallelMode::TREE})
+        {
+            ParallelMCTS parallel(3, 40000, 1.41, threads);
+            parallel.setRng(RNG(9));
+            parallel.setMode(mode);
+
+            MoveType move = CONTINUE;
+            double seconds = timeSeconds([&]()
+                                         { move = parallel.findBestMove(state, 0, true); });
+            std::cout << (mode == ParallelMode::ROOT ? " root " : ", tree ") << std::fixed << std::setprecision(0)
+                      << std::setw(7) << parallel.getLastIterations() / seconds << " iterations/s, "
+                      << std::setw(6) << parallel.getNodesCreated() << " nodes (chose " << move << ")";
+        }
+        std::cout << "\n";
+    }
+}
+
+void leafBenchmarks()
+{
+    std::cout << "Leaf parallelism (MCTS, 3 players, first pick-up decision; K rollouts per leaf over W workers):\n";
+    State state = State(3).doMove(CONTINUE);
+    for (int rollouts : {1, 16, 64})
+    {
+        for (int workers : {1, 2, 4})
+        {
+            if (rollouts == 1 && workers > 1)
+                continue;
+
+            const int iterations = 200000 / (rollouts + 9); // roughly the same work for every K
+            MCTS mcts(3, iterations);
+            mcts.setRng(RNG(4));
+            mcts.setLeafParallelism(rollouts, workers);
+
+            MoveType move = CONTINUE;
+            double seconds = timeSeconds([&]()
+                                         { move = mcts.findBestMove(state, 0, true); });
+            std::cout << "  K " << std::setw(2) << rollouts << ", W " << workers << ": " << std::fixed
+                      << std::setprecision(0) << std::setw(7) << iterations / seconds << " iterations/s, "
+                      << std::setw(8) << static_cast<double>(iterations) * rollouts / seconds
+                      << " rollouts/s (chose " << move << ")\n";
+        }
+    }
+}
+
+// ---------------------------------------------------------------- game length
+
+void scalingBenchmarks()
+{
+    std::cout << "Game length (4 players, longer boards with proportionally more oxygen; per rollout and per MCTS iteration):\n";
+    for (int tiles : {32, 48, 64})
+    {
+        RulesConfig rules;
+        rules.boardTiles = tiles;
+        rules.oxygen = 25 * tiles / BOARD_TILES;
+        State state(4, rules);
+        state.setValuationPolicy(ValuationPolicy::MIDPOINT);
+        std::string label = std::to_string(tiles) + " tiles/" + std::to_string(rules.oxygen) + " O2";
+
+        const int rollouts = 20000;
+        RNG rng(7);
+        BatchRollout batch;
+        std::vector<ScoreVector> scores(rollouts);
+        double checksum = 0;
+        double seconds = timeSeconds([&]()
+                                     {
+            batch.run(state, false, rollouts, rng, scores.data());
+            for (const ScoreVector &s : scores)
+                checksum += s[0]; });
+        report(label + ", rollout", seconds, rollouts, static_cast<uint64_t>(checksum));
+
+        const int iterations = 5000;
+        State pick = state.doMove(CONTINUE);
+        MCTS mcts(4, iterations);
+        MoveType move = CONTINUE;
+        seconds = timeSeconds([&]()
+                              { move = mcts.findBestMove(pick, 0, true); });
+        report(label + ", search", seconds, iterations, move);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::string only;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--only" && i + 1 < argc)
+            only = argv[++i];
+        else if (arg == "--help")
+        {
+            std::cout << "Usage: " << argv[0] << " [--only movement|dice|rollout|terminal|codec|round|search|transpositions|deadline|parallel|leaf|scaling]\n";
+            return 0;
+        }
+    }
+
+    if (only.empty() || only == "movement")
+        movementBenchmarks();
+    if (only.empty() || only == "dice")
+        diceBenchmarks();
+    if (only.empty() || only == "rollout")
+        rolloutBenchmarks();
+    if (only.empty() || only == "terminal")
+        terminalBenchmarks();
+    if (only.empty() || only == "codec")
+        codecBenchmarks();
+    if (only.empty() || only == "round")
+        roundBenchmarks();
+    if (only.empty() || only == "search")
+        searchBenchmarks();
+    if (only.empty() || only == "transpositions")
+        transpositionBenchmarks();
+    if (only.empty() || only == "deadline")
+        deadlineBenchmarks();
+    if (only.empty() || only == "parallel")
+        parallelBenchmarks();
+    if (only.empty() || only == "leaf")
+        leafBenchmarks();
+    if (only.empty() || only == "scaling")
+        scalingBenchmarks();
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+#ifndef TRANSPOSITION_TABLE_HPP
+#define TRANSPOSITION_TABLE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "environment.hpp"
+
+/**
+ * Bounded map from a position (state and movedThisTurn phase) to the search node that holds it,
+ * so move orders and dice sequences that transpose share one node and its statistics.
+ * Buckets hold two entries; a new position evicts the less visited one. An evicted node stays in
+ * the tree, it just can no longer be found.
+ */
+template <typename Node>
+class TranspositionTable
+{
+private:
+    struct Entry
+    {
+        uint64_t key;
+        Node *node;
+    };
+
+    std::vector<Entry> entries;
+    size_t mask = 0;
+    size_t stored = 0;
+
+    size_t bucketOf(uint64_t key) const
+    {
+        return key & mask & ~size_t(1);
+    }
+
+public:
+    // rounded down to a power of two; 0 switches the table off
+    void resize(size_t capacity)
+    {
+        size_t size = 0;
+        if (capacity >= 2)
+        {
+            size = 2;
+            while (size * 2 <= capacity)
+                size *= 2;
+        }
+
+        entries.assign(size, Entry{0, nullptr});
+        mask = size == 0 ? 0 : size - 1;
+        stored = 0;
+    }
+
+    bool enabled() const
+    {
+        return !entries.empty();
+    }
+
+    size_t capacity() const
+    {
+        return entries.size();
+    }
+
+    size_t size() const
+    {
+        return stored;
+    }
+
+    void clear()
+    {
+        std::fill(entries.begin(), entries.end(), Entry{0, nullptr});
+        stored = 0;
+    }
+
+    // the node for the position, if it is still stored; the full state is compared, not just the hash
+    Node *find(const State &state, bool movedThisTurn, uint64_t key) const
+    {
+        const Entry *bucket = &entries[bucketOf(key)];
+        for (int i = 0; i < 2; i++)
+        {
+            Node *node = bucket[i].node;
+            if (node != nullptr && bucket[i].key == key && node->movedThisTurn == movedThisTurn &&
+                node->state == state)
+                return node;
+        }
+        return nullptr;
+    }
+
+    void insert(uint64_t key, Node *node)
+    {
+        Entry *bucket = &entries[bucketOf(key)];
+        Entry *slot = &bucket[0];
+        if (bucket[0].node != nullptr &&
+            (bucket[1].node == nullptr || bucket[1].node->visits < bucket[0].node->visits))
+            slot = &bucket[1];
+
+        if (slot->node == nullptr)
+            stored++;
+        *slot = Entry{key, node};
+    }
+};
+
+#endif // TRANSPOSITION_TABLE_HPP